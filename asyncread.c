@@ -0,0 +1,223 @@
+#include "general.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+Asynchronous reader of B-tree nodes.
+Several node reads are queued and then completed in one batch, 
+so that the disk can serve them in parallel instead of one read after another.
+It talks to io_uring directly through system calls.
+If io_uring is not available (old kernel, or forbidden), 
+the reads of a batch are executed synchronously with pread.
+*/
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ringfd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+
+/*maps submission queue, completion queue and submission entries of the ring into memory*/
+static int mapRings(AsyncReader_t *reader, struct io_uring_params *params)
+{
+	char *sqRing;
+	char *cqRing;
+
+	reader->sqRingSize=params->sq_off.array+params->sq_entries*sizeof(unsigned int);
+	reader->cqRingSize=params->cq_off.cqes+params->cq_entries*sizeof(struct io_uring_cqe);
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+		reader->sqRingSize=reader->cqRingSize=MAX(reader->sqRingSize,reader->cqRingSize);
+	reader->sqesSize=params->sq_entries*sizeof(struct io_uring_sqe);
+
+	sqRing=mmap(NULL,reader->sqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+		reader->ringfd,IORING_OFF_SQ_RING);
+	if(sqRing==MAP_FAILED)
+		return RESULT_ERROR;
+	reader->sqRing=sqRing;
+
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+		cqRing=sqRing;
+	else
+	{
+		cqRing=mmap(NULL,reader->cqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+			reader->ringfd,IORING_OFF_CQ_RING);
+		if(cqRing==MAP_FAILED)
+			return RESULT_ERROR;
+	}
+	reader->cqRing=cqRing;
+
+	reader->sqes=mmap(NULL,reader->sqesSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+		reader->ringfd,IORING_OFF_SQES);
+	if(reader->sqes==MAP_FAILED)
+	{
+		reader->sqes=NULL;
+		return RESULT_ERROR;
+	}
+
+	reader->sqTail=(unsigned int *)(sqRing+params->sq_off.tail);
+	reader->sqMask=(unsigned int *)(sqRing+params->sq_off.ring_mask);
+	reader->sqArray=(unsigned int *)(sqRing+params->sq_off.array);
+	reader->cqHead=(unsigned int *)(cqRing+params->cq_off.head);
+	reader->cqTail=(unsigned int *)(cqRing+params->cq_off.tail);
+	reader->cqMask=(unsigned int *)(cqRing+params->cq_off.ring_mask);
+	reader->cqes=cqRing+params->cq_off.cqes;
+	return 0;
+}
+
+
+/*sets up the ring, on failure the reader works synchronously*/
+int initAsyncReader(AsyncReader_t *reader)
+{
+	struct io_uring_params params;
+
+	memset(reader,0,sizeof(AsyncReader_t));
+	memset(&params,0,sizeof(params));
+
+	reader->ringfd=io_uring_setup(ASYNC_READ_QUEUE_DEPTH,&params);
+	if(reader->ringfd<0)
+	{
+		reader->ringfd=-1;
+		return 0;
+	}
+
+	if(mapRings(reader,&params))
+		closeAsyncReader(reader);
+	return 0;
+}
+
+
+void closeAsyncReader(AsyncReader_t *reader)
+{
+	if(reader->sqes!=NULL)
+		munmap(reader->sqes,reader->sqesSize);
+	if(reader->cqRing!=NULL && reader->cqRing!=reader->sqRing)
+		munmap(reader->cqRing,reader->cqRingSize);
+	if(reader->sqRing!=NULL)
+		munmap(reader->sqRing,reader->sqRingSize);
+	if(reader->ringfd>=0)
+		close(reader->ringfd);
+
+	memset(reader,0,sizeof(AsyncReader_t));
+	reader->ringfd=-1;
+}
+
+
+/*
+reads nodes nodeIDs[0..nodesCount-1] into targets[0..nodesCount-1].
+All reads are submitted at once, and the routine returns when all of them have completed.
+Reads which the ring did not take or did not complete are done with pread,
+and the reader switches to synchronous reads.
+nodesCount must not exceed ASYNC_READ_QUEUE_DEPTH
+*/
+int readNodesAsync(AsyncReader_t *reader, int btreefd, 
+				   unsigned int *nodeIDs, BTreeNode_t **targets, int nodesCount)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int tail,head,index;
+	enum BOOL isRead[ASYNC_READ_QUEUE_DEPTH];
+	int i,submitted,completed,res;
+
+	if(nodesCount>ASYNC_READ_QUEUE_DEPTH)
+	{
+		printf("Too many nodes %d in one asynchronous read batch\n",nodesCount);
+		return RESULT_ERROR;
+	}
+
+	//synchronous fallback
+	if(reader->ringfd<0 || nodesCount<=1)
+	{
+		for(i=0;i<nodesCount;i++)
+		{
+			if(readNodesFromFile(btreefd,nodeIDs[i],1,targets[i]))
+				return RESULT_ERROR;
+		}
+		return 0;
+	}
+
+	//1. fill submission queue entries
+	tail=*reader->sqTail;
+	for(i=0;i<nodesCount;i++,tail++)
+	{
+		index=tail & *reader->sqMask;
+		sqe=&((struct io_uring_sqe *)reader->sqes)[index];
+		memset(sqe,0,sizeof(struct io_uring_sqe));
+		sqe->opcode=IORING_OP_READ;
+		sqe->fd=btreefd;
+		sqe->addr=(unsigned long)targets[i];
+		sqe->len=sizeof(BTreeNode_t);
+		sqe->off=(unsigned long long)getNodeOffset(nodeIDs[i]);
+		sqe->user_data=i;
+		reader->sqArray[index]=index;
+	}
+	__atomic_store_n(reader->sqTail,tail,__ATOMIC_RELEASE);
+
+	//2. submit; the kernel may take only a part of the entries in one call
+	submitted=0;
+	while(submitted<nodesCount)
+	{
+		res=io_uring_enter(reader->ringfd,nodesCount-submitted,0,0);
+		if(res<0 && errno==EINTR)
+			continue;
+		if(res<=0)
+		{
+			printf("io_uring took %d of %d reads: %s, reading synchronously\n",submitted,nodesCount,
+				res<0 ? strerror(errno) : "submission queue was not consumed");
+			break;
+		}
+		submitted+=res;
+	}
+
+	//3. reap completions of the submitted reads
+	for(i=0;i<nodesCount;i++)
+		isRead[i]=FALSE;
+	completed=0;
+	while(completed<submitted)
+	{
+		head=*reader->cqHead;
+		if(head==__atomic_load_n(reader->cqTail,__ATOMIC_ACQUIRE))
+		{
+			res=io_uring_enter(reader->ringfd,0,1,IORING_ENTER_GETEVENTS);
+			if(res<0 && errno!=EINTR)
+			{
+				printf("io_uring wait failed: %s, reading synchronously\n",strerror(errno));
+				break;
+			}
+			continue;
+		}
+
+		cqe=&((struct io_uring_cqe *)reader->cqes)[head & *reader->cqMask];
+		i=(int)cqe->user_data;
+		//short or failed read (for example, IORING_OP_READ is not supported) is repeated with pread
+		if(cqe->res!=(int)sizeof(BTreeNode_t))
+		{
+			if(readNodesFromFile(btreefd,nodeIDs[i],1,targets[i]))
+				return RESULT_ERROR;
+		}
+		isRead[i]=TRUE;
+		completed++;
+		__atomic_store_n(reader->cqHead,head+1,__ATOMIC_RELEASE);
+	}
+
+	//4. the rest is read synchronously. Entries which were not submitted stay in the ring,
+	//so the ring is closed and the next batches are read with pread as well
+	if(completed<nodesCount)
+	{
+		for(i=0;i<nodesCount;i++)
+		{
+			if(isRead[i]==FALSE && readNodesFromFile(btreefd,nodeIDs[i],1,targets[i]))
+				return RESULT_ERROR;
+		}
+		closeAsyncReader(reader);
+	}
+	return 0;
+}
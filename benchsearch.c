@@ -0,0 +1,108 @@
+#include "general.h"
+
+/**
+Microbenchmark of the key search inside a B-tree node:
+linear scan (the original code) against galloping + branchless binary search (nodesearch.c)
+over interleaved Data_t entries, as in internal nodes, 
+and over a contiguous key array with SSE2 compares at the end, as in leaves.
+Two access patterns are measured for several node sizes:
+random - each lookup starts from position 0, as in a descent from scratch;
+sorted - sorted keys, each lookup resumes from the previous position, as in a bucket transfer.
+
+To run: ./benchsearch [lookups]
+*/
+
+static int compareUInt(const void *a, const void *b)
+{
+	unsigned int x=*(const unsigned int *)a;
+	unsigned int y=*(const unsigned int *)b;
+	return (x>y)-(x<y);
+}
+
+static double elapsedNs(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec-start->tv_sec)*1e9+(end->tv_nsec-start->tv_nsec);
+}
+
+#define KERNELS_COUNT 3
+
+/*runs lookups with all kernels, checks that they agree and prints time per lookup*/
+static int benchPattern(const char *pattern, Data_t *data, unsigned int *keys, int keysCount, 
+						unsigned int *queries, int queriesCount, enum BOOL resume)
+{
+	struct timespec start,end;
+	const char *names[KERNELS_COUNT]={"linear","gallop+binary","keys+sse2"};
+	long checksum[KERNELS_COUNT];
+	double ns[KERNELS_COUNT];
+	int k,q,pos,from;
+
+	for(k=0;k<KERNELS_COUNT;k++)	{
+		checksum[k]=0;
+		pos=0;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		for(q=0;q<queriesCount;q++)	{
+			from=(resume==TRUE) ? pos : 0;
+			if(k==0)
+				pos=findFirstNotLessLinear(data, from, keysCount, queries[q]);
+			else if(k==1)
+				pos=findFirstNotLess(data, from, keysCount, queries[q]);
+			else
+				pos=findFirstNotLessKey(keys, from, keysCount, queries[q]);
+			checksum[k]+=pos;
+			if(pos==keysCount)
+				pos=0;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		ns[k]=elapsedNs(&start,&end)/queriesCount;
+	}
+
+	for(k=1;k<KERNELS_COUNT;k++)	{
+		if(checksum[k]!=checksum[0])	{
+			printf("Kernel %s disagrees for %d keys, %s lookups\n",names[k],keysCount,pattern);
+			return RESULT_ERROR;
+		}
+	}
+
+	printf("%5d keys %-7s",keysCount,pattern);
+	for(k=0;k<KERNELS_COUNT;k++)
+		printf("   %s %7.1f ns",names[k],ns[k]);
+	printf("\n");
+	return RESULT_OK;
+}
+
+int main(int argc, char *argv[])
+{
+	int sizes[]={16, 128, 1024, MAX_DATA_PER_NODE};
+	int queriesCount=(argc>1) ? atoi(argv[1]) : 1000000;
+	Data_t *data;
+	unsigned int *keys;
+	unsigned int *queries;
+	int s,i;
+
+	data=(Data_t *) calloc (MAX_DATA_PER_NODE, sizeof(Data_t));
+	keys=(unsigned int *) calloc (MAX_DATA_PER_NODE, sizeof(unsigned int));
+	queries=(unsigned int *) calloc (queriesCount, sizeof(unsigned int));
+	if(data==NULL || keys==NULL || queries==NULL)	{
+		printf("Failed to allocate memory for benchmark\n");
+		return RESULT_ERROR;
+	}
+
+	srand(12345);
+	for(s=0;s<(int)(sizeof(sizes)/sizeof(sizes[0]));s++)	{
+		for(i=0;i<sizes[s];i++)
+			data[i].value=((unsigned int)rand()<<16)^(unsigned int)rand();
+		qsort(data,sizes[s],sizeof(Data_t),compareUInt);
+		for(i=0;i<sizes[s];i++)
+			keys[i]=data[i].value;
+
+		for(i=0;i<queriesCount;i++)
+			queries[i]=((unsigned int)rand()<<16)^(unsigned int)rand();
+		if(benchPattern("random",data,keys,sizes[s],queries,queriesCount,FALSE))
+			return RESULT_ERROR;
+
+		qsort(queries,queriesCount,sizeof(unsigned int),compareUInt);
+		if(benchPattern("sorted",data,keys,sizes[s],queries,queriesCount,TRUE))
+			return RESULT_ERROR;
+	}
+	return RESULT_OK;
+}
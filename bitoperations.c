@@ -68,41 +68,25 @@ void printBitSequenceToFile(FILE *file,unsigned int *bitseq) {
 	}
 }
 
+//the LCP is the number of leading zero bits of the difference
 int getLCP(unsigned int *first, unsigned int *second) {
-	int b=0;
-	
 	unsigned int diff=(*first)^(*second);
-	unsigned int firstone=(unsigned int) (1 << (NUM_BITS_INUINT-1));//number 1000....
-
-	for(;diff!=0;diff=diff<<1)
-	{		
-		if(diff &(firstone))
-		{
-		
-			return b;
-		}
-		b++;
-	}
-	return NUM_BITS_INUINT;  //generally, we are looking for lcp for 2 different keys, hence this is an error
 
+	if(diff==0) //__builtin_clz is undefined for 0
+		return NUM_BITS_INUINT;  //generally, we are looking for lcp for 2 different keys, hence this is an error
+	return __builtin_clz(diff);
 }
 
 int getLCPwithBitsAfterLCP(unsigned int *first, unsigned int *second,char *bit1, char *bit2)
 {
-	int b=0;
-	
 	unsigned int diff=(*first)^(*second);
-	unsigned int firstone=(unsigned int) (1 << (NUM_BITS_INUINT-1));//number 1000...
+	int b;
 
-	for(;diff!=0;diff=diff<<1)
-	{		
-		if(diff &(firstone))
-		{
-			*bit1=getBit(first,b); //b+1
-			*bit2=getBit(second,b);
-			return b;
-		}
-		b++;
-	}
-	return NUM_BITS_INUINT;  //generally, we are looking for lcp for 2 different keys, hence this is an error
+	if(diff==0)
+		return NUM_BITS_INUINT;  //generally, we are looking for lcp for 2 different keys, hence this is an error
+
+	b=__builtin_clz(diff);
+	*bit1=getBit(first,b); //b+1
+	*bit2=getBit(second,b);
+	return b;
 }
\ No newline at end of file
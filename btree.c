@@ -1,4 +1,5 @@
 #include "general.h"
+#include <string.h>
 /**
 Simplistic proof-of-concept implementation of B-tree
 This B-tree code was written because none of the existing open-source B-tree implementations perform 
@@ -8,92 +9,100 @@ We need batch update (inserting multiple keys into the same B-tree node at once)
 in order to execute online update
 */
 
-//inserts key from buffer
-int insertSortedKeyFromBuffer(SystemState_t *state, unsigned int  key, int documentID)
+/*
+inserts a sorted run of keys from buffer (value - key, pointer - document ID).
+Each target leaf receives all keys of the run which belong to it in one merge pass,
+the leaf is split only when it has no space left for the next key
+*/
+int insertSortedBatchFromBuffer(SystemState_t *state, Data_t *keys, int keysCount)
 {
-	BTreeNode_t *currentLeaf;
-	Data_t *leafData;
+	int done=0;
+	int merged;
 
-	short i,j;
-	short nextDocPos;
-	Data_t *nextDoc;
+	state->runMaxKey=keys[keysCount-1].value;
+	while(done<keysCount)	{
+		//the leaf for the next key is at the end of the lastPath, and it can hold at least one more key
+		if(findLeafToInsert(state, keys[done].value))
+			return 1;
 
-	//1. Searches for an appropriate leaf - the result of findleaf is that the 
-	//appropriate leaf is in the last path at currtreelevel
-	//the leaf can hold one more key, the split if needed is already performed
-	if(findLeafToInsert(state, key))	{
-		return 1;
+		merged=mergeSortedRunIntoLeaf(state, state->lastPath[state->curTreeLevel], 
+			&keys[done], keysCount-done);
+		if(merged<=0)	{
+			printf("Failed to merge key %u into leaf %u\n",keys[done].value,
+				state->lastPath[state->curTreeLevel]->header.nodeID);
+			return 1;
+		}
+		done+=merged;
 	}
-	
-	currentLeaf=(state->lastPath[state->curTreeLevel]);
-	leafData=&currentLeaf->data[0];
-
-	for(i=state->lastPathCurrentPointers[state->curTreeLevel];
-		i< currentLeaf->header.keysCount;i++)	{
-		if(leafData[i].value>key)	{
-			//shift
-			for(j=currentLeaf->header.keysCount;j>i;j--) {
-				leafData[j]=leafData[j-1];
-			}
-
-			//add data
-			leafData[i].value=key;
+	return 0;
+}
 
-			//the document id will be stored in the data array starting from the end backwards
-			leafData[i].pointer=currentLeaf->header.dataFreePosArrID;
-		
-			leafData[currentLeaf->header.dataFreePosArrID].value=documentID;
-			leafData[currentLeaf->header.dataFreePosArrID].pointer=0; //unique key - occurs only in this document
-			
+/*
+merges the prefix of the sorted run which belongs to the leaf (keys up to leaf maxKey)
+with the keys of the leaf in one linear pass.
+Documents of new keys and of existing keys are appended to their posting lists, as in a single insert.
+Stops when the leaf has no space for one more key - the same condition as in findLeafToInsert.
+Returns the number of keys taken from the run
+*/
+int mergeSortedRunIntoLeaf(SystemState_t *state, BTreeNode_t *leaf, Data_t *keys, int keysCount)
+{
+	unsigned int mergedKeys[LEAF_MAX_KEYS];
+	PostingHeader_t mergedHeaders[LEAF_MAX_KEYS];
+	PostingHeader_t *postingHeader;
+	LeafPage_t *page=&leaf->leaf;
+	short oldKeysCount=leaf->header.keysCount;
+	short oldPos=0;
+	short mergedCount=0;
+	short lastInsertedPos=0;
+	int i;
 
-			(currentLeaf->header.dataFreePosArrID)--;
+	for(i=0;i<keysCount && keys[i].value<=leaf->header.maxKey;i++)	{
+		//space for 1 key and 1 posting block
+		if(!(oldKeysCount-oldPos+mergedCount<LEAF_MAX_KEYS && leaf->header.dataFreePosArrID>0))
+			break;
 
-			//update position to start from in the next insert
-			state->lastPathCurrentPointers[state->curTreeLevel]=i;
-			
-			(currentLeaf->header.keysCount)++;			
-			return 0;			
+		//copy old keys which go before (or are equal to) the new key
+		while(oldPos<oldKeysCount && page->keys[oldPos]<=keys[i].value)	{
+			mergedKeys[mergedCount]=page->keys[oldPos];
+			mergedHeaders[mergedCount++]=page->postingHeaders[oldPos++];
 		}
 
-		if(leafData[i].value==key) { //the same key but a different document 		
-			nextDoc=&leafData[leafData[i].pointer];
-			nextDocPos=nextDoc->pointer;
-		
-			while(nextDocPos!=0)	{
-				nextDoc=&leafData[nextDocPos];
-				nextDocPos=nextDoc->pointer;			
-			}
+		if(mergedCount>0 && mergedKeys[mergedCount-1]==keys[i].value)	{ 
+			//the same key but a different document - add to the end of its list
+			postingHeader=&mergedHeaders[mergedCount-1];
+		}
+		else	{
+			mergedKeys[mergedCount]=keys[i].value;
+			postingHeader=&mergedHeaders[mergedCount++];
+			postingHeader->docsCount=0;
+			postingHeader->lastBlockBytes=0;
+		}
 
-			nextDoc->pointer=currentLeaf->header.dataFreePosArrID;
-		
-			leafData[currentLeaf->header.dataFreePosArrID].value=documentID;
-			leafData[currentLeaf->header.dataFreePosArrID].pointer=0; //end of chain of document ids
-			
-			(currentLeaf->header.dataFreePosArrID)--;
-			//update position to start from in the next insert
-			state->lastPathCurrentPointers[state->curTreeLevel]=i;			
-			
-			return 0;		
-		}							
+		if(addDocumentToKey(state, leaf, postingHeader, keys[i].pointer))
+			return 0;
+		lastInsertedPos=mergedCount-1;
 	}
-	
-	//if not inserted inside array - add to the end of the array - means the key is bigger than any key already added
-	//but smaller than the artificial largest key of this leaf node
-	leafData[i].value=key;
 
-	//the document id will be stored in the data array starting from the end backwards
-	leafData[i].pointer=currentLeaf->header.dataFreePosArrID;
-	
-	leafData[currentLeaf->header.dataFreePosArrID].value=documentID;
-	leafData[currentLeaf->header.dataFreePosArrID].pointer=0; //unique key - occurs only in this document	
+	if(i==0)
+		return 0;
+
+	while(oldPos<oldKeysCount)	{
+		mergedKeys[mergedCount]=page->keys[oldPos];
+		mergedHeaders[mergedCount++]=page->postingHeaders[oldPos++];
+	}
 
-	(currentLeaf->header.dataFreePosArrID)--;
+	memcpy(page->keys,mergedKeys,mergedCount*sizeof(unsigned int));
+	memcpy(page->postingHeaders,mergedHeaders,mergedCount*sizeof(PostingHeader_t));
+	leaf->header.keysCount=mergedCount;
+	markNodeDirty(state,leaf);
 
 	//update position to start from in the next insert
-	state->lastPathCurrentPointers[state->curTreeLevel]=i;
-	
-	(currentLeaf->header.keysCount)++;				
-	return 0;
+	state->lastPathCurrentPointers[state->curTreeLevel]=lastInsertedPos;
+
+	//frequent keys leave the leaf instead of splitting it
+	if(moveHeavyKeysToOverflow(state, leaf))
+		return 0;
+	return i;
 }
 
 
@@ -117,9 +126,9 @@ int findLeafToInsert(SystemState_t *state, unsigned int keyTobeInserted)
 		leafNode=(state->lastPath[state->curTreeLevel]);
 		if(keyTobeInserted<=leafNode->header.maxKey)
 		{
-			//check if the new key can be added (space) - we need at most 2 Data_t slots: 1 for key 1 for docID
-			//key goes into slot keysCount, and docID in dataFreePosArrID
-			if(leafNode->header.keysCount+1<leafNode->header.dataFreePosArrID-1)
+			//check if the new key can be added (space) - we need at most 1 key slot and 1 posting block
+			//key goes into keys[keysCount], and a new block is postings[dataFreePosArrID]
+			if(leafNode->header.keysCount<LEAF_MAX_KEYS && leafNode->header.dataFreePosArrID>0)
 			{
 				return 0;
 			}
@@ -127,8 +136,11 @@ int findLeafToInsert(SystemState_t *state, unsigned int keyTobeInserted)
 			
 			//split leaf and return corresponding leaf  (pos in it is not set)  (in last path information)
 			//all the settings of new current node and path and
-			//positions in path pointers are set inside the splitLeaf
-			return splitLeaf(state, keyTobeInserted);
+			//positions in path pointers are set inside the splitLeaf.
+			//An uneven split may leave the half for the key full - it is split again
+			if(splitLeaf(state, keyTobeInserted))
+				return 1;
+			return findLeafToInsert(state,keyTobeInserted);
 						
 		}
 
@@ -156,6 +168,8 @@ int findLeafToInsert(SystemState_t *state, unsigned int keyTobeInserted)
 			rootNode->header.keysCount=1;					
 			
 			leafNode->header.maxKey=MAX_UNSIGNED_INT;
+			markNodeDirty(state,rootNode);
+			markNodeDirty(state,leafNode);
 		
 			state->curTreeLevel=1;
 			state->lastPath[state->curTreeLevel]=leafNode;
@@ -212,23 +226,23 @@ int searchDown(SystemState_t *state, unsigned int key) {
 	
 	currNode=(state->lastPath[state->curTreeLevel]);
 	
-	for(i=state->lastPathCurrentPointers[state->curTreeLevel];i<currNode->header.keysCount;i++)	{
-		if(key <=currNode->data[i].value) {
-			state->lastPathCurrentPointers[state->curTreeLevel]=i;			
-			childNodeID=currNode->data[i].pointer;
-			childNode=getNode(state, childNodeID );
-			
-			if(childNode==NULL)	{
-				printf ("Node with ID %u not found while searching down for key %u.\n",childNodeID, key);
-				return 1;
-			}
-			
-			state->curTreeLevel++;
-			
-			state->lastPath[state->curTreeLevel]=childNode;
-			state->lastPathCurrentPointers[state->curTreeLevel]=0;  
-			return searchDown(state,key);
+	i=findFirstNotLess(currNode->data, state->lastPathCurrentPointers[state->curTreeLevel],
+		currNode->header.keysCount, key);
+	if(i<currNode->header.keysCount)	{
+		state->lastPathCurrentPointers[state->curTreeLevel]=i;			
+		childNodeID=currNode->data[i].pointer;
+		childNode=getNode(state, childNodeID );
+		
+		if(childNode==NULL)	{
+			printf ("Node with ID %u not found while searching down for key %u.\n",childNodeID, key);
+			return 1;
 		}
+		
+		state->curTreeLevel++;
+		
+		state->lastPath[state->curTreeLevel]=childNode;
+		state->lastPathCurrentPointers[state->curTreeLevel]=0;  
+		return searchDown(state,key);
 	}
 	
 	printf ("Key %u not found in node %u while searching down\n",key, currNode->header.nodeID);
@@ -238,19 +252,113 @@ int searchDown(SystemState_t *state, unsigned int key) {
 /*
 splits leaf into 2 leaves
 */
+/*
+position in the leaf which splits its keys so that the left part gets percent of them.
+A leaf which ran out of posting blocks, not of keys, is split by blocks:
+otherwise the part with a few long lists is full again (small pages hold only a few lists)
+*/
+static short findLeafSplitPoint(BTreeNode_t *leaf, int percent)
+{
+	int keysCount=leaf->header.keysCount;
+	int usedBlocks;
+	long blocks=0;
+	short half;
+
+	if(keysCount>=LEAF_MAX_KEYS)
+		half=keysCount*percent/100;
+	else	{
+		usedBlocks=LEAF_MAX_POSTING_BLOCKS-1-leaf->header.dataFreePosArrID;
+		for(half=0;half<keysCount-1 && 100*blocks<(long)usedBlocks*percent;half++)
+			blocks+=countPostingBlocks(&leaf->leaf, &leaf->leaf.postingHeaders[half]);
+	}
+	return MIN(MAX(half,1),keysCount-1);
+}
+
+/*
+number of keys which go to the new (left) leaf, according to the split policy.
+0 - the leaf has a single key, its documents are split
+*/
+static short chooseLeafSplit(SystemState_t *state, BTreeNode_t *leaf, unsigned int key)
+{
+	int keysCount=leaf->header.keysCount;
+	int runStart,runEnd;
+	int percent=50;
+
+	runStart=findFirstNotLessKey(leaf->leaf.keys, 0, keysCount, key);
+	if(keysCount<=1) //a bigger key moves away from a single key, otherwise its documents are split
+		return (runStart==keysCount) ? keysCount : 0;
+
+	switch(state->splitPolicy)	{
+	case SPLIT_RATIO:
+		percent=state->splitRatio;
+		break;
+	case SPLIT_APPEND:
+		//the key goes after the keys of the leaf (or to the last one) - only the right part receives the next keys
+		if(runStart>=keysCount-1)
+			percent=SPLIT_APPEND_PERCENT;
+		else if(runStart==0)
+			percent=100-SPLIT_APPEND_PERCENT;
+		break;
+	case SPLIT_RANGE:
+		//keys of the leaf outside [key, runMaxKey] receive nothing from this run: 
+		//the larger of these parts is cut off as it is, full, and the other part takes the run
+		runEnd=findFirstNotLessKey(leaf->leaf.keys, runStart, keysCount, MAX(key,state->runMaxKey));
+		if(runEnd<keysCount && leaf->leaf.keys[runEnd]==MAX(key,state->runMaxKey))
+			runEnd++;
+		if(runStart==runEnd) //no key of the leaf is in the run, it goes between the parts
+			return MAX(runStart,1); //keysCount, if the run starts after all keys: the old leaf is left empty for it
+		if(runStart>=keysCount-runEnd && 4*runStart>=keysCount)
+			return runStart;
+		if(runStart<keysCount-runEnd && 4*(keysCount-runEnd)>=keysCount)
+			return runEnd;
+		break;
+	default:
+		break;
+	}
+	return findLeafSplitPoint(leaf, percent);
+}
+
+/*
+position in the internal node which leaves percent of its children in the left node.
+Children are appended where the new child key goes, so SPLIT_APPEND and SPLIT_RANGE
+split unevenly when the new key goes to the first or to the last child
+*/
+static short chooseInternalSplit(SystemState_t *state, BTreeNode_t *node, unsigned int key)
+{
+	int keysCount=node->header.keysCount;
+	int pos;
+	int percent=50;
+
+	if(state->splitPolicy==SPLIT_RATIO)
+		percent=state->splitRatio;
+	else if(state->splitPolicy==SPLIT_APPEND || state->splitPolicy==SPLIT_RANGE)	{
+		pos=findFirstNotLess(node->data, 0, keysCount, key);
+		if(pos>=keysCount-1)
+			percent=SPLIT_APPEND_PERCENT;
+		else if(pos==0)
+			percent=100-SPLIT_APPEND_PERCENT;
+	}
+	return MIN(MAX(keysCount*percent/100,1),keysCount-1);
+}
+
 int splitLeaf(SystemState_t *state, unsigned int keyTobeInserted) {
 	short half;
 	BTreeNode_t *oldLeaf;
 	BTreeNode_t *newLeaf;
-	Data_t currDoc;
-	short nextDocArrPos;
-	Data_t tempData[MAX_DATA_PER_NODE];
+	BTreeNode_t *prevLeaf;
+	unsigned int prevLeafID;
+	unsigned int newLeafID;
+	LeafPage_t oldPage;
+	unsigned int docIDs[LEAF_MAX_POSTING_BLOCKS*POSTING_BLOCK_BYTES];
+	short oldKeysCount;
 	short i;
+	int docsCount;
 	unsigned int key_unique;
 
 	oldLeaf=state->lastPath[state->curTreeLevel];
 
-	half=oldLeaf->header.keysCount/2;
+	oldKeysCount=oldLeaf->header.keysCount;
+	half=chooseLeafSplit(state, oldLeaf, keyTobeInserted);
 
 	//1. create new leaf	
 	newLeaf=createNewNode (state, LEAF );
@@ -258,129 +366,72 @@ int splitLeaf(SystemState_t *state, unsigned int keyTobeInserted) {
 		printf("Failed to create new leaf during leaf node split\n");
 		return 1;
 	}
+	markNodeDirty(state,oldLeaf);
+	markNodeDirty(state,newLeaf);
 
-	//copy data to the tempData array
-	for(i=0;i<MAX_DATA_PER_NODE;i++)
-		tempData[i]=oldLeaf->data[i];
+	//copy leaf content to the temp page
+	memcpy(&oldPage,&oldLeaf->leaf,sizeof(LeafPage_t));
+	oldLeaf->header.dataFreePosArrID=LEAF_MAX_POSTING_BLOCKS-1;
 
 	if(half>0)	{
 		// new leaf in the first half since we dont want to update the max key value in  the old leaf
 		// 2. set max key data of the new leaf
-		newLeaf->header.maxKey=oldLeaf->data[half-1].value;	
+		newLeaf->header.maxKey=oldPage.keys[half-1];	
 
-		//3. copy keys and docs to the new leaf 
+		//3. copy keys and posting lists to the new leaf 
 		for(i=0;i<half;i++)	{
-			//copy key data 
-			newLeaf->data[i].value=oldLeaf->data[i].value;
-			newLeaf->data[i].pointer=newLeaf->header.dataFreePosArrID;
-	
-			//copy docs list
-			currDoc=oldLeaf->data[oldLeaf->data[i].pointer];
-			newLeaf->data[newLeaf->header.dataFreePosArrID].value=currDoc.value;
-		
-			nextDocArrPos=currDoc.pointer;
-	
-			while (nextDocArrPos!=0)	{
-				newLeaf->data[newLeaf->header.dataFreePosArrID].pointer=(newLeaf->header.dataFreePosArrID-1);
-		
-				currDoc=oldLeaf->data[nextDocArrPos];
-				newLeaf->header.dataFreePosArrID--;
-				newLeaf->data[newLeaf->header.dataFreePosArrID].value=currDoc.value;
-				nextDocArrPos=currDoc.pointer;
-		
-			}
-			newLeaf->data[newLeaf->header.dataFreePosArrID].pointer=0;
-			newLeaf->header.dataFreePosArrID--;		
+			newLeaf->leaf.keys[i]=oldPage.keys[i];
+			if(copyPostingList(newLeaf, &oldPage, &oldPage.postingHeaders[i], &newLeaf->leaf.postingHeaders[i]))
+				return 1;
 		}
-	
-		newLeaf->header.keysCount=i;
+		newLeaf->header.keysCount=half;
 
 		//4. update keys in the old leaf. The maxkey remains with no change	
-		oldLeaf->header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
-
-		for(i=half;i<oldLeaf->header.keysCount;i++)	{
-			oldLeaf->data[i-half].value=tempData[i].value;
-			oldLeaf->data[i-half].pointer=oldLeaf->header.dataFreePosArrID;
-	
-			//copy docs list
-			currDoc=tempData[tempData[i].pointer];
-			oldLeaf->data[oldLeaf->header.dataFreePosArrID].value=currDoc.value;
-		
-			nextDocArrPos=currDoc.pointer;
-	
-			while (nextDocArrPos!=0)	{
-				oldLeaf->data[oldLeaf->header.dataFreePosArrID].pointer=(oldLeaf->header.dataFreePosArrID-1);
-				currDoc=tempData[nextDocArrPos];
-				oldLeaf->header.dataFreePosArrID--;
-				oldLeaf->data[oldLeaf->header.dataFreePosArrID].value=currDoc.value;
-				nextDocArrPos=currDoc.pointer;
-		
-			}
-			oldLeaf->data[oldLeaf->header.dataFreePosArrID].pointer=0;
-			oldLeaf->header.dataFreePosArrID--;	
+		for(i=half;i<oldKeysCount;i++)	{
+			oldLeaf->leaf.keys[i-half]=oldPage.keys[i];
+			if(copyPostingList(oldLeaf, &oldPage, &oldPage.postingHeaders[i], &oldLeaf->leaf.postingHeaders[i-half]))
+				return 1;
 		}
-
-		oldLeaf->header.keysCount=i-half;	
+		oldLeaf->header.keysCount=oldKeysCount-half;	
 	}
 
 	else //the oldLeaf contains only 1 key, the rest is the list of documents
-		//the key is only here: oldLeaf->data[0].value
 	{
-		key_unique=oldLeaf->data[0].value;
+		if(oldPage.postingHeaders[0].lastBlockBytes==POSTINGS_IN_OVERFLOW)	{
+			printf("Leaf %u with a single key in overflow pages cannot be full\n",oldLeaf->header.nodeID);
+			return 1;
+		}
+		key_unique=oldPage.keys[0];
+		docsCount=decodePostings(&oldPage, &oldPage.postingHeaders[0], docIDs);
 		
-		half=MAX_DATA_PER_NODE/2;
-		// 2. set max key data of the new leaf -
+		// 2. set max key data of the new leaf - the first half of documents goes there
 		newLeaf->header.maxKey=key_unique;	
-		newLeaf->data[0].value=key_unique;
-		newLeaf->data[0].pointer=newLeaf->header.dataFreePosArrID;
-		//3. copy docs to the new leaf 		
-		currDoc=oldLeaf->data[oldLeaf->data[0].pointer];
-		i=1;
-
-		//copy docs list (half of it)
-		while(i<half)	{			
-			i++;
-			newLeaf->data[newLeaf->header.dataFreePosArrID].value=currDoc.value;			
-			if(i<half)
-				newLeaf->data[newLeaf->header.dataFreePosArrID].pointer
-					=newLeaf->header.dataFreePosArrID-1;
-			else
-				newLeaf->data[newLeaf->header.dataFreePosArrID].pointer=0;
-					
-			nextDocArrPos=currDoc.pointer;
-						
-			currDoc=oldLeaf->data[nextDocArrPos];
-			newLeaf->header.dataFreePosArrID--;				
+		newLeaf->leaf.keys[0]=key_unique;
+		newLeaf->leaf.postingHeaders[0].docsCount=0;
+		newLeaf->leaf.postingHeaders[0].lastBlockBytes=0;
+		for(i=0;i<docsCount/2;i++)	{
+			if(appendPosting(newLeaf, &newLeaf->leaf.postingHeaders[0], docIDs[i]))
+				return 1;
 		}
-		
 		newLeaf->header.keysCount=1;
 
-		//4. update keys in the old leaf. The maxkey remains with no change	
-		oldLeaf->header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
-		//oldLeaf->data[0].value remains the same
-		oldLeaf->data[0].pointer=oldLeaf->header.dataFreePosArrID;
-
-		oldLeaf->data[oldLeaf->header.dataFreePosArrID].value=currDoc.value;
-		oldLeaf->data[oldLeaf->header.dataFreePosArrID].pointer
-				=oldLeaf->header.dataFreePosArrID-1;
-		oldLeaf->header.dataFreePosArrID--;
-		
-		nextDocArrPos=currDoc.pointer;
-		while(nextDocArrPos!=0)	{
-			currDoc=tempData[nextDocArrPos];
-			oldLeaf->data[oldLeaf->header.dataFreePosArrID].value=currDoc.value;
-			if(currDoc.pointer!=0)	{
-				oldLeaf->data[oldLeaf->header.dataFreePosArrID].pointer
-					=oldLeaf->header.dataFreePosArrID-1;				
-			}
-			else
-				oldLeaf->data[oldLeaf->header.dataFreePosArrID].pointer=0;	
-			oldLeaf->header.dataFreePosArrID--;	
-			nextDocArrPos=currDoc.pointer;
+		//4. the rest of documents stays in the old leaf. The maxkey remains with no change	
+		oldLeaf->leaf.keys[0]=key_unique;
+		oldLeaf->leaf.postingHeaders[0].docsCount=0;
+		oldLeaf->leaf.postingHeaders[0].lastBlockBytes=0;
+		for(i=docsCount/2;i<docsCount;i++)	{
+			if(appendPosting(oldLeaf, &oldLeaf->leaf.postingHeaders[0], docIDs[i]))
+				return 1;
 		}
-
 		oldLeaf->header.keysCount=1;	
 	}
+	//the new leaf goes before the old one in the chain of leaves
+	prevLeafID=oldPage.prevLeaf;
+	newLeafID=newLeaf->header.nodeID;
+	newLeaf->leaf.prevLeaf=prevLeafID;
+	newLeaf->leaf.nextLeaf=oldLeaf->header.nodeID;
+	oldLeaf->leaf.prevLeaf=newLeafID;
+
 	//5. Depending on where the current key falls to - set currentNode at the end of the current path
 	//position in current node after split is reset to 0
 	state->lastPathCurrentPointers[state->curTreeLevel]=0;
@@ -392,6 +443,18 @@ int splitLeaf(SystemState_t *state, unsigned int keyTobeInserted) {
 	if(updateLeafParentAfterSplit(state,   newLeaf,  keyTobeInserted))
 		return 1;
 
+	//7. the left neighbour links to the new leaf. It is read last, 
+	//since reading it may evict the half of the split which is not on the lastPath
+	if(prevLeafID!=0)	{
+		prevLeaf=getNode(state, prevLeafID);
+		if(prevLeaf==NULL)	{
+			printf("Left neighbour %u of leaf %u not found during leaf split\n",prevLeafID,newLeafID);
+			return 1;
+		}
+		prevLeaf->leaf.nextLeaf=newLeafID;
+		markNodeDirty(state,prevLeaf);
+	}
+
 	return 0;
 }
 
@@ -404,28 +467,29 @@ int updateLeafParentAfterSplit(SystemState_t *state,
 	BTreeNode_t *parentNode;
 	
 	parentNode=state->lastPath[state->curTreeLevel -1];
+	markNodeDirty(state,parentNode);
 
 	//1. check if there is enough space to insert the new max value of a new child leaf
 	if(parentNode->header.keysCount<MAX_DATA_PER_NODE)	{
-		for(j=0;j<parentNode->header.keysCount;j++)  //new key is always smaller than one of old keys, since we create new leaf from the smallest half
+		//new key is always smaller than one of old keys, since we create new leaf from the smallest half
+		j=findFirstNotLess(parentNode->data, 0, parentNode->header.keysCount, keyTobeInserted);
+		if(j<parentNode->header.keysCount)
 		{
-			if(keyTobeInserted<=parentNode->data[j].value) {
 			//shift to insert new value before the current pointer of this node			
-				for(i=parentNode->header.keysCount;i>j;i--)
-				{
-					parentNode->data[i]=parentNode->data[i-1];
-				}
-				
-				parentNode->data[j].value=newLeaf->header.maxKey;
-				parentNode->data[j].pointer=newLeaf->header.nodeID;
+			for(i=parentNode->header.keysCount;i>j;i--)
+			{
+				parentNode->data[i]=parentNode->data[i-1];
+			}
 			
-				(parentNode->header.keysCount)++;
+			parentNode->data[j].value=newLeaf->header.maxKey;
+			parentNode->data[j].pointer=newLeaf->header.nodeID;
+		
+			(parentNode->header.keysCount)++;
 
-				//we reset the position to start the search here also for safety
-				state->lastPathCurrentPointers[state->curTreeLevel -1]=0;				
-			
-				return 0;
-			}
+			//we reset the position to start the search here also for safety
+			state->lastPathCurrentPointers[state->curTreeLevel -1]=0;				
+		
+			return 0;
 		}
 		printf("Logic error. The key to be inserted from a new leaf is not smaller than any existing key in the parent node.\n");
 		return 1;
@@ -455,12 +519,11 @@ int splitRoot(SystemState_t *state, unsigned int keyTobeInserted,
 	BTreeNode_t *rootNode;
 	
 	short i,j;	
-	enum BOOL inserted=FALSE;
 
 	rootNode=state->lastPath[0];
 
-	half=rootNode->header.keysCount/2;
-	//split the node in half (by number of keys)
+	//split the node by number of keys
+	half=chooseInternalSplit(state, rootNode, keyForParentUpdate);
 	
 	//1. create new leaft child
 	leftNode=createNewNode (state, INTERNAL );
@@ -479,12 +542,18 @@ int splitRoot(SystemState_t *state, unsigned int keyTobeInserted,
 
 	leftNode->header.keysCount=i;
 	
-	//4. create new right child
+	//4. create new right child. The left child is not on the lastPath yet:
+	//it is held, so that the replacement policy does not give its frame to the right child
+	holdNodeInMemory(state,leftNode,TRUE);
 	rightNode= createNewNode (state, INTERNAL );
+	holdNodeInMemory(state,leftNode,FALSE);
 	if(rightNode==NULL)	{
 		printf("failed to create new node as a right child of a splitting root\n");
 		return 1;
 	}
+	markNodeDirty(state,rootNode);
+	markNodeDirty(state,leftNode);
+	markNodeDirty(state,rightNode);
 
 	// 5. set max key of the right child
 	rightNode->header.maxKey=rootNode->header.maxKey;
@@ -517,36 +586,32 @@ int splitRoot(SystemState_t *state, unsigned int keyTobeInserted,
 
 	//5. Split was required to insert some key (the max key of the splitted child
 	if(keyForParentUpdate<=leftNode->header.maxKey)	{
-		for(i=0;i<leftNode->header.keysCount && inserted==FALSE;i++)	{
-			if(keyForParentUpdate <= leftNode->data[i].value)	{
-				//shift and insert
-				for(j=leftNode->header.keysCount;j>i;j--)	{
-					leftNode->data[j]=leftNode->data[j-1];
-				}
-				leftNode->data[i].value=keyForParentUpdate;
-				leftNode->data[i].pointer=childID;
-
-				leftNode->header.keysCount++;
-				inserted=TRUE;
-			}		
+		i=findFirstNotLess(leftNode->data, 0, leftNode->header.keysCount, keyForParentUpdate);
+		if(i<leftNode->header.keysCount)	{
+			//shift and insert
+			for(j=leftNode->header.keysCount;j>i;j--)	{
+				leftNode->data[j]=leftNode->data[j-1];
+			}
+			leftNode->data[i].value=keyForParentUpdate;
+			leftNode->data[i].pointer=childID;
+
+			leftNode->header.keysCount++;
 		}
 		state->lastPath[1]=leftNode;
 	}
 	else //new child pointer goes to the right node
 	{
-		for(i=0;i<rightNode->header.keysCount && inserted==FALSE;i++)	{
-			if(keyForParentUpdate <= rightNode->data[i].value)	{
-				//shift and insert
-				for(j=rightNode->header.keysCount;j>i;j--)	{
-					rightNode->data[j]=rightNode->data[j-1];
-				}
-				
-				rightNode->data[i].value=keyForParentUpdate;
-				rightNode->data[i].pointer=childID;	
-
-				rightNode->header.keysCount++;
-				inserted=TRUE;
-			}		
+		i=findFirstNotLess(rightNode->data, 0, rightNode->header.keysCount, keyForParentUpdate);
+		if(i<rightNode->header.keysCount)	{
+			//shift and insert
+			for(j=rightNode->header.keysCount;j>i;j--)	{
+				rightNode->data[j]=rightNode->data[j-1];
+			}
+			
+			rightNode->data[i].value=keyForParentUpdate;
+			rightNode->data[i].pointer=childID;	
+
+			rightNode->header.keysCount++;
 		}
 		state->lastPath[1]=rightNode;
 	}
@@ -568,11 +633,9 @@ int splitInternal(SystemState_t *state, unsigned int keyTobeInserted,  int nodeL
 	BTreeNode_t *newNode;
 	short i,j;
 
-	enum BOOL inserted=FALSE;
-
 	oldNode=state->lastPath[nodeLevel];
 	
-	half=oldNode->header.keysCount/2;
+	half=chooseInternalSplit(state, oldNode, keyForParentUpdate);
 	
 	//2. create new node
 	newNode=createNewNode (state, INTERNAL );
@@ -580,6 +643,8 @@ int splitInternal(SystemState_t *state, unsigned int keyTobeInserted,  int nodeL
 		printf("failed to create new node during internal node split \n");
 		return 1;
 	}
+	markNodeDirty(state,oldNode);
+	markNodeDirty(state,newNode);
 
 	// new node in the first half since we dont want to update the max key value in the old node
 	// 3. set max key of a new leaf
@@ -599,35 +664,31 @@ int splitInternal(SystemState_t *state, unsigned int keyTobeInserted,  int nodeL
 
 	//5. Split was required to insert some key (the max key of the splitted child
 	if(keyForParentUpdate<=newNode->header.maxKey)	{
-		for(i=0;i<newNode->header.keysCount && inserted==FALSE;i++)	{
-			if(keyForParentUpdate<=newNode->data[i].value)	{
-				//shift and insert
-				for(j=newNode->header.keysCount;j>i;j--) {
-					newNode->data[j]=newNode->data[j-1];
-				}
-				newNode->data[i].value=keyForParentUpdate;
-				newNode->data[i].pointer=childID;
-
-				newNode->header.keysCount++;
-				inserted=TRUE;
-			}		
+		i=findFirstNotLess(newNode->data, 0, newNode->header.keysCount, keyForParentUpdate);
+		if(i<newNode->header.keysCount)	{
+			//shift and insert
+			for(j=newNode->header.keysCount;j>i;j--) {
+				newNode->data[j]=newNode->data[j-1];
+			}
+			newNode->data[i].value=keyForParentUpdate;
+			newNode->data[i].pointer=childID;
+
+			newNode->header.keysCount++;
 		}
 		state->lastPath[nodeLevel]=newNode;
 	}
 	else //new child pointer goes to the old node
 	{
-		for(i=0;i<oldNode->header.keysCount && inserted==FALSE;i++)	{
-			if(keyForParentUpdate<=oldNode->data[i].value)	{
-				//shift and insert
-				for(j=oldNode->header.keysCount;j>i;j--)	{
-					oldNode->data[j]=oldNode->data[j-1];
-				}
-				oldNode->data[i].value=keyForParentUpdate;
-				oldNode->data[i].pointer=childID;
-			
-				oldNode->header.keysCount++;
-				inserted=TRUE;
-			}		
+		i=findFirstNotLess(oldNode->data, 0, oldNode->header.keysCount, keyForParentUpdate);
+		if(i<oldNode->header.keysCount)	{
+			//shift and insert
+			for(j=oldNode->header.keysCount;j>i;j--)	{
+				oldNode->data[j]=oldNode->data[j-1];
+			}
+			oldNode->data[i].value=keyForParentUpdate;
+			oldNode->data[i].pointer=childID;
+		
+			oldNode->header.keysCount++;
 		}
 		state->lastPath[nodeLevel]=oldNode;
 	}
@@ -649,23 +710,23 @@ int updateNodeParentAfterSplit(SystemState_t *state,
 	short i,j;
 	BTreeNode_t *parentNode;
 	parentNode=state->lastPath[nodeLevel -1];	
+	markNodeDirty(state,parentNode);
 	
 	//check if it can accomodate one more key
 	if(parentNode->header.keysCount<MAX_DATA_PER_NODE)	{		
-		for(j=0;j<parentNode->header.keysCount;j++)	{
-			if(newNode->header.maxKey<=parentNode->data[j].value)	{
-				//shift to insert new value before the current pointer of this node
-				for(i=parentNode->header.keysCount;i>j;i--)		{
-					parentNode->data[i]=parentNode->data[i-1];
-				}
-			
-				parentNode->data[j].value=newNode->header.maxKey;
-				parentNode->data[j].pointer=newNode->header.nodeID;
-			
-				parentNode->header.keysCount++;
-				state->lastPathCurrentPointers[nodeLevel -1]=0;					
-				return 0;		
+		j=findFirstNotLess(parentNode->data, 0, parentNode->header.keysCount, newNode->header.maxKey);
+		if(j<parentNode->header.keysCount)	{
+			//shift to insert new value before the current pointer of this node
+			for(i=parentNode->header.keysCount;i>j;i--)		{
+				parentNode->data[i]=parentNode->data[i-1];
 			}
+		
+			parentNode->data[j].value=newNode->header.maxKey;
+			parentNode->data[j].pointer=newNode->header.nodeID;
+		
+			parentNode->header.keysCount++;
+			state->lastPathCurrentPointers[nodeLevel -1]=0;					
+			return 0;		
 		}
 	}
 
@@ -681,6 +742,72 @@ int updateNodeParentAfterSplit(SystemState_t *state,
 	return 0;
 }
 
+/*
+prefetches in one batch the children of internal node, starting from position fromPos,
+which may contain keys up to maxKey
+*/
+int prefetchChildrenInRange(SystemState_t *state, BTreeNode_t *node, int fromPos, unsigned int maxKey) {
+	unsigned int childIDs[ASYNC_READ_QUEUE_DEPTH];
+	int i,count=0;
+
+	//one batch takes at most a quarter of the pool, the rest of the descent still needs free frames
+	for(i=fromPos;i<node->header.keysCount && count<PREFETCH_CHILDREN_NODES;i++)	{
+		childIDs[count++]=node->data[i].pointer;
+		//child i+1 holds keys starting from data[i].value
+		if(node->data[i].value>maxKey)
+			break;
+	}
+
+	if(count<2) //single child is loaded on demand
+		return 0;
+	return prefetchNodes(state, childIDs, count);
+}
+
+/*
+Before a sorted batch of keys from [minKey,maxKey] is inserted,
+reads in all internal nodes and leaves this key range is going to touch.
+The tree is resolved level by level, and each level is read in batches of ASYNC_READ_QUEUE_DEPTH,
+so the misses of one bucket transfer overlap instead of happening one by one in searchDown
+*/
+int prefetchKeyRange(SystemState_t *state, unsigned int minKey, unsigned int maxKey) {
+	unsigned int levelIDs[2][PREFETCH_MAX_NODES];
+	int levelCount[2];
+	int curr=0,next;
+	int i,j;
+	BTreeNode_t *node;
+
+	levelIDs[curr][0]=state->lastPath[0]->header.nodeID;
+	levelCount[curr]=1;
+
+	while(levelCount[curr]>0)	{
+		next=1-curr;
+		levelCount[next]=0;
+
+		for(i=0;i<levelCount[curr] && levelCount[next]<PREFETCH_MAX_NODES;i++)	{
+			node=getNode(state, levelIDs[curr][i]);
+			if(node==NULL)
+				return 1;
+			if(node->header.nodeType==LEAF) //the whole level consists of leaves
+				return 0;
+
+			//child j holds keys up to data[j].value, and child j+1 may start with the same key
+			j=findFirstNotLess(node->data, 0, node->header.keysCount, minKey);
+			for(;j<node->header.keysCount && levelCount[next]<PREFETCH_MAX_NODES;j++)	{
+				levelIDs[next][levelCount[next]++]=node->data[j].pointer;
+				if(node->data[j].value>maxKey)
+					break;
+			}
+		}
+
+		for(i=0;i<levelCount[next];i+=ASYNC_READ_QUEUE_DEPTH)	{
+			if(prefetchNodes(state, &levelIDs[next][i], MIN(ASYNC_READ_QUEUE_DEPTH, levelCount[next]-i)))
+				return 1;
+		}
+		curr=next;
+	}
+	return 0;
+}
+
 int resetBTreePath(SystemState_t *state) {
 	short i;
 
@@ -693,22 +820,33 @@ int resetBTreePath(SystemState_t *state) {
 
 int checkCircularReference(BTreeNode_t *currentLeaf) {	
 	int i;
+	PostingHeader_t *postingHeader;
+
 	for(i=0;i<currentLeaf->header.keysCount;i++) {
-		if(currentLeaf->data[i].pointer==i)	{
-			printf("Circular reference 1\n");
+		postingHeader=&currentLeaf->leaf.postingHeaders[i];
+		if(postingHeader->lastBlockBytes==POSTINGS_IN_OVERFLOW)
+			continue;
+		if(postingHeader->firstBlock<=currentLeaf->header.dataFreePosArrID
+			|| postingHeader->lastBlock<=currentLeaf->header.dataFreePosArrID)	{
+			printf("Key points to a free posting block\n");
+			return 1;
+		}
+		if(currentLeaf->leaf.postings[postingHeader->lastBlock].next!=0)	{
+			printf("Last block of a key is not the end of its chain\n");
 			return 1;
 		}
 	}
 
-	for(i=MAX_DATA_PER_NODE-1;i>currentLeaf->header.dataFreePosArrID;i--) {
-		if(currentLeaf->data[i].pointer==i)	{
-			printf("Circular reference 2\n");
+	//blocks are allocated backwards, so a chain always goes to smaller positions
+	for(i=LEAF_MAX_POSTING_BLOCKS-1;i>currentLeaf->header.dataFreePosArrID;i--) {
+		if(currentLeaf->leaf.postings[i].next>=i)	{
+			printf("Circular reference\n");
 			return 1;
 		}
 	}
 
-	if(currentLeaf->header.keysCount>=currentLeaf->header.dataFreePosArrID)	{
-		printf("Keys and docs overlap\n");
+	if(currentLeaf->header.keysCount>LEAF_MAX_KEYS || currentLeaf->header.dataFreePosArrID<0)	{
+		printf("Keys or posting blocks overflow\n");
 		return 1;
 	}
 	
@@ -717,20 +855,26 @@ int checkCircularReference(BTreeNode_t *currentLeaf) {
 
 int invalidLeaf(BTreeNode_t *currLeaf) {
 	int i;
+	PostingHeader_t *postingHeader;
+
 	for(i=0;i<currLeaf->header.keysCount;i++)	{
-		if(currLeaf->data[i].value==0)	{
+		postingHeader=&currLeaf->leaf.postingHeaders[i];
+		if(currLeaf->leaf.keys[i]==0)	{
 			printf("Zero key\n");
 			return 1;
 		}
-		if(currLeaf->data[i].pointer==0)	{
+		if(postingHeader->docsCount<=0)	{
 			printf("Zero pointer to doc\n");
 			return 1;
 		}
-	}
-
-	for(i=MAX_DATA_PER_NODE-1;i>currLeaf->header.dataFreePosArrID;i--)	{
-		if(currLeaf->data[i].value<=0)	{
-			printf("Invalid (zero) docID\n");
+		if(postingHeader->lastBlockBytes==POSTINGS_IN_OVERFLOW)
+			continue;
+		if(postingHeader->firstBlock==0)	{
+			printf("Zero pointer to doc\n");
+			return 1;
+		}
+		if(postingHeader->lastBlockBytes<=0 || postingHeader->lastBlockBytes>POSTING_BLOCK_BYTES)	{
+			printf("Invalid size of the last posting block\n");
 			return 1;
 		}
 	}
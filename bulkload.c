@@ -0,0 +1,619 @@
+#include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+Builds a new B-tree file from a collection of documents bottom-up,
+instead of inserting every (key, docID) pair through the buffer and splitting nodes.
+
+1. Documents are parsed as in onlineupdate, and the pairs are collected in a run in memory.
+A full run is sorted by key (radix sort, which keeps documents of a key in their order)
+and written to a temporary run file next to the B-tree file.
+2. The runs are merged, and the sorted pairs are packed into leaves, which are written one after another.
+Posting lists of heavy keys are written to overflow pages on the way, as the online update does.
+3. Internal levels are built from the maximal keys of the level below, and the top level becomes the root (node 0).
+
+Leaves and internal nodes are filled up to the fill factor, so that the following online updates
+add keys to the leaves without splitting them at once.
+The result is an ordinary B-tree file with its size file, which onlineupdate keeps updating.
+
+To run: ./bulkload <inputfolder> <inputfileprefix> <minSubscript> <maxSubscript> <fileextension>
+<outputfolder> <btreefilename> <filedelta> [fill factor in percent, default 90]
+*/
+int transfercounter;
+
+#define BULK_RUN_PAIRS (8*1024*1024) //pairs sorted in memory at once, 64 MB
+#define BULK_MERGE_READ_PAIRS (64*1024) //pairs read at once from each run file during the merge
+#define BULK_DEFAULT_FILL 90
+#define BULK_MIN_FILL 50
+
+typedef struct
+{
+	FILE *file;
+	Data_t *pairs;
+	int count;
+	int pos;
+}BulkRun_t;
+
+typedef struct
+{
+	char btreeFileName[MAX_PATH_LENGTH];
+	int btreefd;
+	unsigned int nextNodeID; //node 0 is kept for the root, which is written last
+	int fillKeys;  //leaf is closed when it has this many keys
+	int fillBlocks;  //or this many posting blocks are taken
+	int fillEntries;  //entries per internal node
+
+	//1. sorted runs
+	Data_t *run;
+	Data_t *sortTemp;
+	int runCount;
+	int runFilesCount;
+
+	//2. the key being collected and the leaf being filled
+	unsigned int key;
+	unsigned int *docIDs;
+	int docsCount;
+	int docsCapacity;
+	unsigned char *code; //varints of docIDs
+	int codeBytes;
+	int codeCapacity;
+	BTreeNode_t *leaf;
+	unsigned int lastLeafID; //the leaf written before, prevLeaf of the current one
+	BTreeNode_t *page; //overflow pages and internal nodes are built here
+
+	//3. maximal keys and IDs of the nodes of the level being built
+	Data_t *level;
+	int levelCount;
+	int levelCapacity;
+
+	unsigned long pairsCount;
+	unsigned int keysCount;
+	unsigned int leavesCount;
+	unsigned int overflowPagesCount;
+	int treeHeight;
+}BulkLoader_t;
+
+/*fileName has MAX_PATH_LENGTH bytes*/
+static int getRunFileName(BulkLoader_t *loader, int runID, char *fileName)
+{
+	if(snprintf(fileName,MAX_PATH_LENGTH,"%s_run%d",loader->btreeFileName,runID)>=MAX_PATH_LENGTH)	{
+		printf("Name of run file %d of %s is too long\n",runID,loader->btreeFileName);
+		return RESULT_ERROR;
+	}
+	return RESULT_OK;
+}
+
+/*grows an array of elementSize elements to hold at least needed elements*/
+static int ensureCapacity(void **array, int *capacity, int needed, size_t elementSize)
+{
+	void *grown;
+	int newCapacity=MAX(*capacity,1024);
+
+	if(needed<=*capacity)
+		return RESULT_OK;
+	while(newCapacity<needed)
+		newCapacity*=2;
+	grown=realloc(*array,(size_t)newCapacity*elementSize);
+	if(grown==NULL)	{
+		printf("Failed to allocate memory for %d elements of size %lu\n",newCapacity,elementSize);
+		return RESULT_ERROR;
+	}
+	*array=grown;
+	*capacity=newCapacity;
+	return RESULT_OK;
+}
+
+/*
+sorts the run by key with 4 passes of 8 bits.
+The sort is stable: pairs come in the order of documents, and documents of each key stay in this order
+*/
+static void sortRun(BulkLoader_t *loader)
+{
+	int counts[256];
+	Data_t *from=loader->run;
+	Data_t *to=loader->sortTemp;
+	Data_t *swapped;
+	int shift;
+	int i,sum,digit;
+
+	for(shift=0;shift<32;shift+=8)	{
+		memset(counts,0,sizeof(counts));
+		for(i=0;i<loader->runCount;i++)
+			counts[(from[i].value>>shift)&0xff]++;
+		for(sum=0,digit=0;digit<256;digit++)	{
+			i=counts[digit];
+			counts[digit]=sum;
+			sum+=i;
+		}
+		for(i=0;i<loader->runCount;i++)
+			to[counts[(from[i].value>>shift)&0xff]++]=from[i];
+		swapped=from;
+		from=to;
+		to=swapped;
+	}
+	//even number of passes - the sorted run is back in loader->run
+}
+
+static int writeRunToFile(BulkLoader_t *loader)
+{
+	char runFileName[MAX_PATH_LENGTH];
+	FILE *runfile;
+
+	sortRun(loader);
+	if(getRunFileName(loader,loader->runFilesCount,runFileName))
+		return RESULT_ERROR;
+	if(!(runfile= fopen ( runFileName , "wb" )))	{
+		printf("Could not create run file %s \n",runFileName);
+		return RESULT_ERROR;
+	}
+	if(fwrite(loader->run,sizeof(Data_t),loader->runCount,runfile)!=(size_t)loader->runCount)	{
+		printf("Failed to write %d pairs to run file %s\n",loader->runCount,runFileName);
+		return RESULT_ERROR;
+	}
+	fclose(runfile);
+	loader->runFilesCount++;
+	loader->runCount=0;
+	return RESULT_OK;
+}
+
+static int addPairToRun(BulkLoader_t *loader, unsigned int key, unsigned int docID)
+{
+	if(loader->runCount==BULK_RUN_PAIRS && writeRunToFile(loader))
+		return RESULT_ERROR;
+	loader->run[loader->runCount].value=key;
+	loader->run[loader->runCount].pointer=docID;
+	loader->runCount++;
+	return RESULT_OK;
+}
+
+static int writeBulkNode(BulkLoader_t *loader, BTreeNode_t *node)
+{
+	if(writeNodeToFile(loader->btreefd, node))	{
+		printf("Failed to write node %u of the new BTree\n",node->header.nodeID);
+		return RESULT_ERROR;
+	}
+	return RESULT_OK;
+}
+
+static int addToLevel(BulkLoader_t *loader, unsigned int maxKey, unsigned int nodeID)
+{
+	if(ensureCapacity((void **)&loader->level, &loader->levelCapacity, loader->levelCount+1, sizeof(Data_t)))
+		return RESULT_ERROR;
+	loader->level[loader->levelCount].value=maxKey;
+	loader->level[loader->levelCount].pointer=nodeID;
+	loader->levelCount++;
+	return RESULT_OK;
+}
+
+static void initBulkLeaf(BTreeNode_t *leaf)
+{
+	leaf->header.keysCount=0;
+	leaf->header.dataFreePosArrID=LEAF_MAX_POSTING_BLOCKS-1;
+	leaf->header.nodeType=LEAF;
+}
+
+/*
+the leaf is written when it is full. Its maximal key is the last key, or MAX_UNSIGNED_INT for the last leaf.
+A leaf which is not the last is closed right before the next key is added,
+and the next leaf takes the next node ID with this key
+*/
+static int flushLeaf(BulkLoader_t *loader, enum BOOL lastLeaf)
+{
+	BTreeNode_t *leaf=loader->leaf;
+
+	leaf->header.maxKey=lastLeaf ? MAX_UNSIGNED_INT : leaf->leaf.keys[leaf->header.keysCount-1];
+	leaf->leaf.nextLeaf=lastLeaf ? 0 : loader->nextNodeID;
+	if(writeBulkNode(loader, leaf) || addToLevel(loader, leaf->header.maxKey, leaf->header.nodeID))
+		return RESULT_ERROR;
+	loader->leavesCount++;
+	loader->lastLeafID=leaf->header.nodeID;
+	initBulkLeaf(leaf);
+	return RESULT_OK;
+}
+
+/*
+writes the varints of the collected key into a chain of consecutive overflow pages.
+The number of pages is known in advance, so each page is written once
+*/
+static int writeOverflowChain(BulkLoader_t *loader, PostingHeader_t *postingHeader)
+{
+	BTreeNode_t *page=loader->page;
+	unsigned int firstPageID=loader->nextNodeID;
+	unsigned int pagesCount=(loader->codeBytes+OVERFLOW_PAGE_BYTES-1)/OVERFLOW_PAGE_BYTES;
+	unsigned int written=0;
+	unsigned int i;
+
+	for(i=0;i<pagesCount;i++)	{
+		memset(&page->header,0,sizeof(NodeHeader_t));
+		page->header.nodeID=loader->nextNodeID++;
+		page->header.nodeType=OVERFLOW;
+		page->header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
+		page->overflow.nextPage=(i+1<pagesCount) ? page->header.nodeID+1 : 0;
+		page->overflow.lastPage=(i==0) ? firstPageID+pagesCount-1 : page->header.nodeID;
+		page->overflow.usedBytes=MIN(OVERFLOW_PAGE_BYTES,loader->codeBytes-written);
+		memcpy(page->overflow.bytes,&loader->code[written],page->overflow.usedBytes);
+		written+=page->overflow.usedBytes;
+		if(writeBulkNode(loader, page))
+			return RESULT_ERROR;
+	}
+	loader->overflowPagesCount+=pagesCount;
+
+	postingHeader->overflowPage=firstPageID;
+	postingHeader->lastBlockBytes=POSTINGS_IN_OVERFLOW;
+	postingHeader->docsCount=loader->docsCount;
+	postingHeader->lastDocID=loader->docIDs[loader->docsCount-1];
+	return RESULT_OK;
+}
+
+/*
+adds the collected key with all its documents to the current leaf,
+closing the leaf first if the key does not fit under the fill factor.
+Heavy keys, and lists too long for a leaf, go to overflow pages
+*/
+static int addKeyToLeaves(BulkLoader_t *loader)
+{
+	BTreeNode_t *leaf=loader->leaf;
+	PostingHeader_t postingHeader;
+	int blocksNeeded;
+	int usedBlocks;
+	int i;
+
+	if(loader->docsCount==0)
+		return RESULT_OK;
+
+	blocksNeeded=(loader->codeBytes+POSTING_BLOCK_BYTES-1)/POSTING_BLOCK_BYTES;
+	if(loader->docsCount>=OVERFLOW_THRESHOLD_DOCS || blocksNeeded>loader->fillBlocks)	{
+		if(writeOverflowChain(loader, &postingHeader))
+			return RESULT_ERROR;
+		blocksNeeded=0;
+	}
+
+	usedBlocks=LEAF_MAX_POSTING_BLOCKS-1-leaf->header.dataFreePosArrID;
+	if(leaf->header.keysCount>=loader->fillKeys || usedBlocks+blocksNeeded>loader->fillBlocks)	{
+		if(flushLeaf(loader, FALSE))
+			return RESULT_ERROR;
+	}
+
+	if(leaf->header.keysCount==0)	{
+		leaf->header.nodeID=loader->nextNodeID++;
+		leaf->leaf.prevLeaf=loader->lastLeafID;
+	}
+	leaf->leaf.keys[leaf->header.keysCount]=loader->key;
+	if(blocksNeeded==0)
+		leaf->leaf.postingHeaders[leaf->header.keysCount]=postingHeader;
+	else	{
+		leaf->leaf.postingHeaders[leaf->header.keysCount].docsCount=0;
+		leaf->leaf.postingHeaders[leaf->header.keysCount].lastBlockBytes=0;
+		for(i=0;i<loader->docsCount;i++)	{
+			if(appendPosting(leaf, &leaf->leaf.postingHeaders[leaf->header.keysCount], loader->docIDs[i]))
+				return RESULT_ERROR;
+		}
+	}
+	leaf->header.keysCount++;
+	loader->keysCount++;
+	loader->docsCount=0;
+	loader->codeBytes=0;
+	return RESULT_OK;
+}
+
+/*receives the merged pairs in key order*/
+static int addSortedPair(BulkLoader_t *loader, unsigned int key, unsigned int docID)
+{
+	PostingHeader_t encoder;
+
+	if(loader->docsCount>0 && key!=loader->key && addKeyToLeaves(loader))
+		return RESULT_ERROR;
+	loader->key=key;
+
+	if(ensureCapacity((void **)&loader->docIDs, &loader->docsCapacity, loader->docsCount+1, sizeof(unsigned int))
+		|| ensureCapacity((void **)&loader->code, &loader->codeCapacity,
+			loader->codeBytes+POSTING_VARINT_MAX_BYTES, sizeof(unsigned char)))
+		return RESULT_ERROR;
+
+	//the encoder needs only the count and the last document of the key
+	encoder.docsCount=loader->docsCount;
+	encoder.lastDocID=(loader->docsCount>0) ? loader->docIDs[loader->docsCount-1] : 0;
+	loader->codeBytes+=encodePosting(&encoder, docID, &loader->code[loader->codeBytes]);
+	loader->docIDs[loader->docsCount++]=docID;
+	loader->pairsCount++;
+	return RESULT_OK;
+}
+
+/*reads the next portion of the run file, returns the number of pairs read*/
+static int refillRun(BulkRun_t *run)
+{
+	run->count=fread(run->pairs,sizeof(Data_t),BULK_MERGE_READ_PAIRS,run->file);
+	run->pos=0;
+	return run->count;
+}
+
+/*
+heap of run IDs ordered by the key at the head of the run.
+Equal keys are taken from the earlier run first: it holds earlier documents
+*/
+static int runIsLess(BulkRun_t *runs, int a, int b)
+{
+	unsigned int keyA=runs[a].pairs[runs[a].pos].value;
+	unsigned int keyB=runs[b].pairs[runs[b].pos].value;
+
+	return keyA<keyB || (keyA==keyB && a<b);
+}
+
+static void siftDownRun(BulkRun_t *runs, int *heap, int heapSize, int i)
+{
+	int child;
+	int top=heap[i];
+
+	while((child=2*i+1)<heapSize)	{
+		if(child+1<heapSize && runIsLess(runs, heap[child+1], heap[child]))
+			child++;
+		if(!runIsLess(runs, heap[child], top))
+			break;
+		heap[i]=heap[child];
+		i=child;
+	}
+	heap[i]=top;
+}
+
+/*merges the run files, together with the last run which is still in memory, into the leaves*/
+static int mergeRuns(BulkLoader_t *loader)
+{
+	BulkRun_t *runs;
+	BulkRun_t *run;
+	int *heap;
+	int heapSize=0;
+	int runsCount=loader->runFilesCount;
+	char runFileName[MAX_PATH_LENGTH];
+	int i;
+
+	sortRun(loader);
+	if(runsCount==0)	{
+		//everything fitted in memory - no merge is needed
+		for(i=0;i<loader->runCount;i++)	{
+			if(addSortedPair(loader, loader->run[i].value, loader->run[i].pointer))
+				return RESULT_ERROR;
+		}
+		return RESULT_OK;
+	}
+
+	runs=(BulkRun_t *) calloc (runsCount+1, sizeof(BulkRun_t));
+	heap=(int *) calloc (runsCount+1, sizeof(int));
+	if(runs==NULL || heap==NULL)	{
+		printf("Failed to allocate memory for merging %d runs\n",runsCount+1);
+		return RESULT_ERROR;
+	}
+	for(i=0;i<runsCount;i++)	{
+		if(getRunFileName(loader,i,runFileName))
+			return RESULT_ERROR;
+		runs[i].pairs=(Data_t *) malloc (BULK_MERGE_READ_PAIRS*sizeof(Data_t));
+		if(runs[i].pairs==NULL)	{
+			printf("Failed to allocate memory for reading run file %s\n",runFileName);
+			return RESULT_ERROR;
+		}
+		if(!(runs[i].file= fopen ( runFileName , "rb" )))	{
+			printf("Could not open run file %s \n",runFileName);
+			return RESULT_ERROR;
+		}
+		if(refillRun(&runs[i])>0)
+			heap[heapSize++]=i;
+	}
+	//the last run is read directly from memory
+	runs[runsCount].pairs=loader->run;
+	runs[runsCount].count=loader->runCount;
+	if(loader->runCount>0)
+		heap[heapSize++]=runsCount;
+
+	for(i=heapSize/2-1;i>=0;i--)
+		siftDownRun(runs, heap, heapSize, i);
+
+	while(heapSize>0)	{
+		run=&runs[heap[0]];
+		if(addSortedPair(loader, run->pairs[run->pos].value, run->pairs[run->pos].pointer))
+			return RESULT_ERROR;
+		run->pos++;
+		if(run->pos==run->count && (run->file==NULL || refillRun(run)==0))
+			heap[0]=heap[--heapSize];
+		if(heapSize>0)
+			siftDownRun(runs, heap, heapSize, 0);
+	}
+
+	for(i=0;i<runsCount;i++)	{
+		fclose(runs[i].file);
+		free(runs[i].pairs);
+		if(getRunFileName(loader,i,runFileName)==RESULT_OK)
+			remove(runFileName);
+	}
+	free(runs);
+	free(heap);
+	return RESULT_OK;
+}
+
+/*
+packs the nodes of the current level into parents, level by level,
+until the top level fits into the root
+*/
+static int buildInternalLevels(BulkLoader_t *loader)
+{
+	BTreeNode_t *node=loader->page;
+	Data_t *children;
+	int childrenCount;
+	int nodesCount;
+	int perNode;
+	int from;
+	int i;
+
+	loader->treeHeight=1;
+	while(loader->levelCount>loader->fillEntries)	{
+		if(++loader->treeHeight>=MAX_TREE_HEIGHT)	{
+			printf("New BTree is higher than %d levels\n",MAX_TREE_HEIGHT);
+			return RESULT_ERROR;
+		}
+
+		children=loader->level;
+		childrenCount=loader->levelCount;
+		loader->level=NULL;
+		loader->levelCount=0;
+		loader->levelCapacity=0;
+
+		//children are spread evenly, so the last node is not almost empty
+		nodesCount=(childrenCount+loader->fillEntries-1)/loader->fillEntries;
+		for(from=0,i=0;i<nodesCount;i++,from+=perNode)	{
+			perNode=childrenCount/nodesCount+((i<childrenCount%nodesCount) ? 1 : 0);
+			memset(&node->header,0,sizeof(NodeHeader_t));
+			node->header.nodeID=loader->nextNodeID++;
+			node->header.nodeType=INTERNAL;
+			node->header.keysCount=perNode;
+			node->header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
+			memcpy(node->data,&children[from],perNode*sizeof(Data_t));
+			node->header.maxKey=node->data[perNode-1].value;
+			if(writeBulkNode(loader, node) || addToLevel(loader, node->header.maxKey, node->header.nodeID))
+				return RESULT_ERROR;
+		}
+		free(children);
+	}
+
+	//the top level goes to the root
+	memset(&node->header,0,sizeof(NodeHeader_t));
+	node->header.nodeID=0;
+	node->header.nodeType=ROOT;
+	node->header.keysCount=loader->levelCount;
+	node->header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
+	node->header.maxKey=(loader->levelCount>0) ? MAX_UNSIGNED_INT : 0;
+	if(loader->levelCount>0)
+		memcpy(node->data,loader->level,loader->levelCount*sizeof(Data_t));
+	return writeBulkNode(loader, node);
+}
+
+int main(int argc, char *argv[])
+{
+	BulkLoader_t *loader;
+	char inputFilePrefix[MAX_PATH_LENGTH];
+	char currInputFileName[MAX_PATH_LENGTH];
+	char sizeFileName[MAX_PATH_LENGTH];
+	char *fileextension;
+	char *inputbuffer;
+	unsigned int *hashedwords;
+	unsigned int *temparray;
+	FILE *sizefile;
+	int minsubsript;
+	int maxsubscript;
+	int filedelta;
+	int fillFactor=BULK_DEFAULT_FILL;
+	int distinctWords;
+	int docID;
+	int i,j;
+
+	if(argc<9)	{
+		printf("To run: ./bulkload <inputfolder> <inputfileprefix>  <minSubscript> <maxSubscript>"
+			"<fileextension> <outputfolder> <btreefilename> <filedelta> [fill factor in percent]\n");
+		return RESULT_ERROR;
+	}
+
+	loader=(BulkLoader_t *) calloc (1, sizeof(BulkLoader_t));
+	if(loader==NULL)	{
+		printf("Failed to allocate memory for bulk loader state of size: %lu \n",sizeof(BulkLoader_t));
+		return RESULT_ERROR;
+	}
+
+	if(snprintf(inputFilePrefix,sizeof(inputFilePrefix),"%s%s", argv[1],
+		(atoi(argv[2])!=-1) ? argv[2] : "")>=(int)sizeof(inputFilePrefix))	{
+		printf("Input file prefix %s%s is too long\n",argv[1],argv[2]);
+		return RESULT_ERROR;
+	}
+	minsubsript=atoi(argv[3]);
+	maxsubscript=atoi(argv[4]);
+	fileextension=argv[5];
+	if(snprintf(loader->btreeFileName,sizeof(loader->btreeFileName),"%s%s", argv[6], argv[7])
+		>=(int)sizeof(loader->btreeFileName)
+		|| snprintf(sizeFileName,sizeof(sizeFileName),"%s_size", loader->btreeFileName)>=(int)sizeof(sizeFileName))	{
+		printf("BTree file name %s%s is too long\n",argv[6],argv[7]);
+		return RESULT_ERROR;
+	}
+	filedelta=atoi(argv[8]);
+	if(argc>9)
+		fillFactor=atoi(argv[9]);
+	if(fillFactor<BULK_MIN_FILL || fillFactor>100)	{
+		printf("Fill factor %d is out of range, expected %d to 100 percent\n",fillFactor,BULK_MIN_FILL);
+		return RESULT_ERROR;
+	}
+
+	loader->fillKeys=MAX(1,LEAF_MAX_KEYS*fillFactor/100);
+	loader->fillBlocks=(LEAF_MAX_POSTING_BLOCKS-1)*fillFactor/100;
+	loader->fillEntries=MAX(2,MAX_DATA_PER_NODE*fillFactor/100);
+	loader->nextNodeID=1;
+
+	//the new B-tree is created from scratch, an existing file is never overwritten
+	if((loader->btreefd=open(loader->btreeFileName, O_RDWR | O_CREAT | O_EXCL, 0644))<0)	{
+		printf("Could not create new BTree file %s - it should not exist\n",loader->btreeFileName);
+		return RESULT_ERROR;
+	}
+	if(!(sizefile= fopen ( sizeFileName , "wb" )))	{
+		printf("Could not create new size file %s \n",sizeFileName);
+		return RESULT_ERROR;
+	}
+
+	inputbuffer=(char*) calloc (INPUT_BUFFER_MAX, sizeof(char));
+	hashedwords=(unsigned int*) calloc (INPUT_BUFFER_MAX, sizeof(unsigned int));
+	temparray=(unsigned int*) calloc (INPUT_BUFFER_MAX, sizeof(unsigned int));
+	loader->run=(Data_t *) malloc (BULK_RUN_PAIRS*sizeof(Data_t));
+	loader->sortTemp=(Data_t *) malloc (BULK_RUN_PAIRS*sizeof(Data_t));
+	loader->leaf=(BTreeNode_t *) calloc (1, sizeof(BTreeNode_t));
+	loader->page=(BTreeNode_t *) calloc (1, sizeof(BTreeNode_t));
+	if(inputbuffer==NULL || hashedwords==NULL || temparray==NULL || loader->run==NULL
+		|| loader->sortTemp==NULL || loader->leaf==NULL || loader->page==NULL)	{
+		printf("Failed to allocate memory for bulk loading\n");
+		return RESULT_ERROR;
+	}
+	initBulkLeaf(loader->leaf);
+
+	prepareCodeTable();
+
+	//1. parse documents into sorted runs
+	for(i=minsubsript;i<=maxsubscript;i++)	{
+		docID=i-filedelta;
+		if(snprintf(currInputFileName,sizeof(currInputFileName),"%s%d%s", inputFilePrefix, i,fileextension)
+			>=(int)sizeof(currInputFileName))	{
+			printf("Input file name %s%d%s is too long\n",inputFilePrefix,i,fileextension);
+			return RESULT_ERROR;
+		}
+		if(readDocumentWords(currInputFileName,inputbuffer,hashedwords,temparray,&distinctWords))
+			return RESULT_ERROR;
+		for(j=0;j<distinctWords;j++)	{
+			if(addPairToRun(loader, hashedwords[j], docID))
+				return RESULT_ERROR;
+		}
+	}
+	free(inputbuffer);
+	free(hashedwords);
+	free(temparray);
+
+	//2. merge runs into leaves
+	if(mergeRuns(loader) || addKeyToLeaves(loader))	{
+		printf("Failed to build leaves of BTree file %s\n",loader->btreeFileName);
+		return RESULT_ERROR;
+	}
+	if(loader->leaf->header.keysCount>0 && flushLeaf(loader, TRUE))
+		return RESULT_ERROR;
+
+	//3. internal levels and the root
+	if(buildInternalLevels(loader))	{
+		printf("Failed to build internal levels of BTree file %s\n",loader->btreeFileName);
+		return RESULT_ERROR;
+	}
+
+	if(fsync(loader->btreefd))	{
+		printf("Failed to flush BTree file %s\n",loader->btreeFileName);
+		return RESULT_ERROR;
+	}
+	close(loader->btreefd);
+	if(writeBTreeSize(sizefile,loader->nextNodeID,0,0))
+		return RESULT_ERROR;
+	fclose(sizefile);
+
+	printf("Loaded %lu documents of %u keys into %u leaves, %u overflow pages and %u nodes, height %d\n",
+		loader->pairsCount,loader->keysCount,loader->leavesCount,loader->overflowPagesCount,
+		loader->nextNodeID,loader->treeHeight+1);
+	return RESULT_OK;
+}
@@ -0,0 +1,217 @@
+#include "general.h"
+#include <string.h>
+
+/**
+Online compaction of the B-tree.
+Nodes are only ever split: after skewed transfers or uneven split policies
+under-filled nodes stay in the tree, and the file and the scans grow with the history of the insertions.
+compactBTree walks the tree once, bottom-up, and merges neighbour children of the same parent
+when together they fill at most COMPACT_FILL_PERCENT of a node, so the merged node still has room for new keys.
+The right node is merged into the left one, the parent entry of the left node takes the max key of the right one,
+and the right node goes to the free list, which createNewNode uses before it extends the file.
+A root with a single internal child takes over the entries of the child, so the tree becomes lower.
+
+Only children of the same parent are merged: a merge rewrites one parent and does not change any key above it.
+Nodes being merged are kept on lastPath below their parent, so the memory pool does not evict them
+*/
+
+/*the two neighbours fit into one node which is at most COMPACT_FILL_PERCENT full*/
+static enum BOOL canMergeNodes(BTreeNode_t *left, BTreeNode_t *right)
+{
+	int keysCount=left->header.keysCount+right->header.keysCount;
+	int usedBlocks;
+
+	if(left->header.nodeType!=LEAF)
+		return (100*keysCount<=COMPACT_FILL_PERCENT*MAX_DATA_PER_NODE) ? TRUE : FALSE;
+
+	//blocks of a leaf are allocated without gaps, from the end of the heap
+	usedBlocks=2*((int)LEAF_MAX_POSTING_BLOCKS-1)-left->header.dataFreePosArrID-right->header.dataFreePosArrID;
+	return (100*keysCount<=COMPACT_FILL_PERCENT*LEAF_MAX_KEYS
+		&& 100*usedBlocks<=COMPACT_FILL_PERCENT*((int)LEAF_MAX_POSTING_BLOCKS-1)) ? TRUE : FALSE;
+}
+
+/*
+appends keys and posting lists of the right leaf to the left leaf,
+the left leaf takes over the max key and the next leaf link of the right one
+*/
+static int mergeLeaves(SystemState_t *state, BTreeNode_t *left, BTreeNode_t *right)
+{
+	short count=left->header.keysCount;
+	short i;
+
+	for(i=0;i<right->header.keysCount;i++)	{
+		left->leaf.keys[count+i]=right->leaf.keys[i];
+		if(copyPostingList(left, &right->leaf, &right->leaf.postingHeaders[i], &left->leaf.postingHeaders[count+i]))
+			return 1;
+	}
+	left->header.keysCount=count+right->header.keysCount;
+	left->header.maxKey=right->header.maxKey;
+	left->leaf.nextLeaf=right->leaf.nextLeaf;
+	markNodeDirty(state,left);
+	return 0;
+}
+
+/*appends child entries of the right internal node to the left one*/
+static void mergeInternalNodes(SystemState_t *state, BTreeNode_t *left, BTreeNode_t *right)
+{
+	memcpy(&left->data[left->header.keysCount],right->data,right->header.keysCount*sizeof(Data_t));
+	left->header.keysCount+=right->header.keysCount;
+	left->header.maxKey=right->header.maxKey;
+	markNodeDirty(state,left);
+}
+
+/*
+merges neighbour children of the node at lastPath[level] from left to right.
+A left child takes over as many right neighbours as fit, then the first one which does not fit
+becomes the next left child. Leaves which follow a merged leaf get their prevLeaf link fixed
+*/
+static int compactChildren(SystemState_t *state, int level, CompactionStats_t *stats)
+{
+	BTreeNode_t *parent=state->lastPath[level];
+	BTreeNode_t *left=NULL;
+	BTreeNode_t *right;
+	BTreeNode_t *nextLeaf;
+	enum BOOL leftMerged=FALSE; //the current left child took over its right neighbour
+	int prefetchedTo=0;
+	int i=0;
+
+	if(level+2>=MAX_TREE_HEIGHT)	{
+		printf("B-tree is too high to compact node %u\n",parent->header.nodeID);
+		return 1;
+	}
+
+	while(i+1<parent->header.keysCount)	{
+		//children are read in batches, as in a range scan
+		if(i+1>=prefetchedTo)	{
+			prefetchChildrenInRange(state, parent, i, MAX_UNSIGNED_INT);
+			prefetchedTo=i+PREFETCH_CHILDREN_NODES;
+		}
+
+		state->curTreeLevel=level;
+		left=getNode(state, parent->data[i].pointer);
+		if(left==NULL)	{
+			printf("Child %d of node %u not found during compaction\n",i,parent->header.nodeID);
+			return 1;
+		}
+		state->lastPath[level+1]=left;
+		state->curTreeLevel=level+1;
+
+		right=getNode(state, parent->data[i+1].pointer);
+		if(right==NULL)	{
+			printf("Child %d of node %u not found during compaction\n",i+1,parent->header.nodeID);
+			return 1;
+		}
+		state->lastPath[level+2]=right;
+		state->curTreeLevel=level+2;
+
+		if(canMergeNodes(left, right)==FALSE)	{
+			if(right->header.nodeType==LEAF && right->leaf.prevLeaf!=left->header.nodeID)	{
+				right->leaf.prevLeaf=left->header.nodeID;
+				markNodeDirty(state,right);
+			}
+			leftMerged=FALSE;
+			i++;
+			continue;
+		}
+
+		if(left->header.nodeType==LEAF)	{
+			if(mergeLeaves(state, left, right))
+				return 1;
+			stats->leavesMerged++;
+		}
+		else	{
+			mergeInternalNodes(state, left, right);
+			stats->internalMerged++;
+		}
+		leftMerged=TRUE;
+
+		//the entry of the left child covers the keys of both children
+		parent->data[i].value=parent->data[i+1].value;
+		memmove(&parent->data[i+1],&parent->data[i+2],
+			(parent->header.keysCount-i-2)*sizeof(Data_t));
+		parent->header.keysCount--;
+		markNodeDirty(state,parent);
+
+		freeNode(state,right);
+	}
+
+	//the last child took over leaves whose next leaf is under another parent
+	if(leftMerged==TRUE && left->header.nodeType==LEAF && left->leaf.nextLeaf!=0)	{
+		state->curTreeLevel=level+1;
+		nextLeaf=getNode(state, left->leaf.nextLeaf);
+		if(nextLeaf==NULL)	{
+			printf("Right neighbour %u of leaf %u not found during compaction\n",
+				left->leaf.nextLeaf,left->header.nodeID);
+			return 1;
+		}
+		nextLeaf->leaf.prevLeaf=left->header.nodeID;
+		markNodeDirty(state,nextLeaf);
+	}
+
+	state->curTreeLevel=level;
+	return 0;
+}
+
+/*compacts the subtrees of all internal children of the node at lastPath[level], then its own children*/
+static int compactSubtree(SystemState_t *state, int level, CompactionStats_t *stats)
+{
+	BTreeNode_t *node=state->lastPath[level];
+	BTreeNode_t *child;
+	int i;
+
+	for(i=0;i<node->header.keysCount;i++)	{
+		child=getNode(state, node->data[i].pointer);
+		if(child==NULL)	{
+			printf("Child %d of node %u not found during compaction\n",i,node->header.nodeID);
+			return 1;
+		}
+		if(child->header.nodeType==LEAF) //all children of this node are leaves
+			break;
+
+		state->lastPath[level+1]=child;
+		state->curTreeLevel=level+1;
+		if(compactSubtree(state, level+1, stats))
+			return 1;
+		state->curTreeLevel=level;
+	}
+
+	return compactChildren(state, level, stats);
+}
+
+/*
+merges under-filled neighbour nodes of the whole tree and removes root levels with a single child.
+Released nodes go to the free list. The insertion path starts from the root afterwards
+*/
+int compactBTree(SystemState_t *state, CompactionStats_t *stats)
+{
+	BTreeNode_t *root;
+	BTreeNode_t *child;
+
+	memset(stats,0,sizeof(CompactionStats_t));
+	resetBTreePath(state);
+	root=state->lastPath[0];
+	if(root->header.keysCount==0) //empty tree
+		return 0;
+
+	if(compactSubtree(state, 0, stats))
+		return 1;
+
+	//node 0 is always the root: it takes the entries of its only child
+	while(root->header.keysCount==1)	{
+		child=getNode(state, root->data[0].pointer);
+		if(child==NULL)	{
+			printf("Child of the root not found during compaction\n");
+			return 1;
+		}
+		if(child->header.nodeType!=INTERNAL)
+			break;
+		memcpy(root->data,child->data,child->header.keysCount*sizeof(Data_t));
+		root->header.keysCount=child->header.keysCount;
+		markNodeDirty(state,root);
+		freeNode(state,child);
+		stats->levelsRemoved++;
+	}
+
+	resetBTreePath(state);
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include "general.h"
+/**
+Ordered scan of the keys of the B-tree with their posting lists.
+seekCursor descends once from the root to the leaf of the first key not less than fromKey,
+then nextCursor moves through the keys of the leaf and follows nextLeaf links to the following leaves,
+so a range or a full scan never goes up and down the tree again.
+
+Leaves ahead of the cursor are read in batches: the descent prefetches the children of each node in the range,
+and every CURSOR_READAHEAD_LEAVES leaves the next part of the range is read ahead with prefetchKeyRange.
+
+The cursor keeps node IDs, not node pointers, so the memory pool may evict its leaf between calls.
+The tree must not be updated while a cursor is open: a split moves keys to another leaf
+*/
+
+/*
+positions the cursor before the first key not less than fromKey.
+The scan returns keys up to toKey, including it
+*/
+int seekCursor(SystemState_t *state, BTreeCursor_t *cursor, unsigned int fromKey, unsigned int toKey)
+{
+	BTreeNode_t *node;
+	unsigned int nodeID;
+	int i;
+
+	cursor->state=state;
+	cursor->toKey=toKey;
+	cursor->leafID=0;
+	cursor->pos=0;
+	cursor->leavesToReadAhead=CURSOR_READAHEAD_LEAVES;
+	cursor->keyLeafID=0;
+
+	node=getNode(state, 0);
+	while(node!=NULL && node->header.nodeType!=LEAF)	{
+		i=findFirstNotLess(node->data, 0, node->header.keysCount, fromKey);
+		if(i==node->header.keysCount) //empty tree
+			return RESULT_OK;
+		nodeID=node->data[i].pointer;
+		//all leaves of the range under this node are read in one batch
+		if(toKey>=node->data[i].value)
+			prefetchChildrenInRange(state, node, i, toKey);
+		node=getNode(state, nodeID);
+	}
+	if(node==NULL)	{
+		printf("Node not found while seeking cursor to key %u\n",fromKey);
+		return RESULT_ERROR;
+	}
+
+	cursor->leafID=node->header.nodeID;
+	cursor->pos=findFirstNotLessKey(node->leaf.keys, 0, node->header.keysCount, fromKey);
+	return RESULT_OK;
+}
+
+/*
+moves the cursor to the next key: sets key, keyLeafID and postingHeader (the number of documents).
+Returns RESULT_NOT_FOUND after the last key of the range
+*/
+int nextCursor(BTreeCursor_t *cursor)
+{
+	BTreeNode_t *leaf;
+	unsigned int maxKey;
+
+	while(cursor->leafID!=0)	{
+		leaf=getNode(cursor->state, cursor->leafID);
+		if(leaf==NULL)	{
+			printf("Leaf %u not found during scan\n",cursor->leafID);
+			return RESULT_ERROR;
+		}
+
+		if(cursor->pos<leaf->header.keysCount)	{
+			if(leaf->leaf.keys[cursor->pos]>cursor->toKey)
+				break;
+			cursor->key=leaf->leaf.keys[cursor->pos];
+			cursor->postingHeader=leaf->leaf.postingHeaders[cursor->pos];
+			cursor->keyLeafID=cursor->leafID;
+			cursor->pos++;
+			return RESULT_OK;
+		}
+
+		//the next leaf starts with a key bigger than maxKey, or with maxKey itself
+		maxKey=leaf->header.maxKey;
+		if(maxKey>cursor->toKey)
+			break;
+		cursor->leafID=leaf->leaf.nextLeaf;
+		cursor->pos=0;
+		if(--cursor->leavesToReadAhead==0 && cursor->leafID!=0)	{
+			if(prefetchKeyRange(cursor->state, maxKey, cursor->toKey))
+				return RESULT_ERROR;
+			cursor->leavesToReadAhead=CURSOR_READAHEAD_LEAVES;
+		}
+	}
+
+	cursor->leafID=0;
+	return RESULT_NOT_FOUND;
+}
+
+/*
+decodes the documents of the current key into docIDs,
+which must hold postingHeader.docsCount elements. Returns the number of decoded documents
+*/
+int readCursorPostings(BTreeCursor_t *cursor, unsigned int *docIDs)
+{
+	BTreeNode_t *leaf;
+
+	leaf=getNode(cursor->state, cursor->keyLeafID);
+	if(leaf==NULL)	{
+		printf("Leaf %u not found while reading postings of key %u\n",cursor->keyLeafID,cursor->key);
+		return 0;
+	}
+	return decodeKeyPostings(cursor->state, &leaf->leaf, &cursor->postingHeader, docIDs);
+}
@@ -1,26 +1,51 @@
 #include "general.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 
+/*
+size file holds BTreeFileHeader_t: the number of nodes in the B-tree file, the page size,
+the version of the node layouts it was written with and the chain of free nodes.
+A B-tree file is opened only by a program compiled for the same page size.
+Version 2 files have the same nodes and no free list - they are read with an empty one
+*/
 unsigned int getBTreeSize(SystemState_t *state)
 {
-	unsigned int buf[1];
+	BTreeFileHeader_t fileHeader;
 	int filesize;
 	int res;
 
 	fseek (state->sizefile, 0, SEEK_END);
     filesize=ftell (state->sizefile);
 
+	state->freeListHead=0;
+	state->freeNodesCount=0;
 	if(filesize==0)
 		return 0;
 
-	if(filesize!=sizeof(unsigned int))
+	if(filesize==sizeof(unsigned int))
+	{
+		printf("BTree size file has no page size: the file was written by an older version with %d-byte nodes,"
+			" rebuild it or convert it with ./migrate\n",LEGACY_PAGE_SIZE);
+		exit(1);
+	}
+
+	if(filesize==2*sizeof(unsigned int))
+	{
+		printf("BTree file was written by an older version without leaf sibling links, rebuild it with ./bulkload\n");
+		exit(1);
+	}
+
+	if(filesize!=sizeof(BTreeFileHeader_t) && filesize!=3*sizeof(unsigned int))
 	{
 		printf("error reading size  file \n");
 		exit(1);
 	}
 
+	memset(&fileHeader,0,sizeof(BTreeFileHeader_t));
 	rewind(state->sizefile);
-	res=fread(&buf[0],sizeof(unsigned int),1,state->sizefile);
+	res=fread(&fileHeader,filesize,1,state->sizefile);
 
 	if(res!=1)
 	{
@@ -28,34 +53,105 @@ unsigned int getBTreeSize(SystemState_t *state)
 		exit(1);
 	}
 
+	//version 2 header ends before the free list, which is empty
+	if(fileHeader.formatVersion==2 && filesize==3*sizeof(unsigned int))
+		fileHeader.formatVersion=BTREE_FORMAT_VERSION;
+
+	if(fileHeader.formatVersion!=BTREE_FORMAT_VERSION)
+	{
+		printf("BTree file has format version %u, this program reads version %d\n",
+			fileHeader.formatVersion,BTREE_FORMAT_VERSION);
+		exit(1);
+	}
+
+	if(fileHeader.pageSize!=BTREE_PAGE_SIZE)
+	{
+		printf("BTree file has pages of %u bytes, this program uses %d bytes - run onlineupdate_%uk\n",
+			fileHeader.pageSize,BTREE_PAGE_SIZE,fileHeader.pageSize/1024);
+		exit(1);
+	}
+
+	state->freeListHead=fileHeader.freeListHead;
+	state->freeNodesCount=fileHeader.freeNodesCount;
 	rewind(state->sizefile);
-	return buf[0];
+	return fileHeader.nodesCount;
 
 }
 
-//TBD - more efficient sizeof() division and multiplication
-int moveInBTreeFile(FILE* btreefile, unsigned int nodeID)
+/*writes the number of nodes, the page size and the free list into the size file, from its beginning*/
+int writeBTreeSize(FILE *sizefile, unsigned int nodesCount, unsigned int freeListHead, unsigned int freeNodesCount)
 {
-	unsigned int remainder;
-	unsigned int max_move=2000000000/sizeof(BTreeNode_t);
+	BTreeFileHeader_t fileHeader;
 
-	rewind(btreefile);
-	if(nodeID<max_move)
+	fileHeader.nodesCount=nodesCount;
+	fileHeader.pageSize=BTREE_PAGE_SIZE;
+	fileHeader.formatVersion=BTREE_FORMAT_VERSION;
+	fileHeader.freeListHead=freeListHead;
+	fileHeader.freeNodesCount=freeNodesCount;
+	rewind(sizefile);
+	if(fwrite(&fileHeader,sizeof(BTreeFileHeader_t),1,sizefile)!=1)
 	{
-		fseek(btreefile, (int)nodeID*sizeof(BTreeNode_t), SEEK_SET);
-		return 0;
+		printf("Failed to save new BTree file size\n");
+		return RESULT_ERROR;
 	}
+	return 0;
+}
 
+/*
+B-tree file is an array of nodes: node nodeID starts at nodeID*sizeof(BTreeNode_t).
+Nodes are read and written with positional I/O (pread/pwrite):
+no seeking, no stdio buffer in between, one system call per node,
+and the calls can be issued from several threads on the same descriptor
+*/
+off_t getNodeOffset(unsigned int nodeID)
+{
+	return (off_t)nodeID*(off_t)sizeof(BTreeNode_t);
+}
 
-	remainder=nodeID;
-	
-	
-	while(remainder>=max_move)
+/*reads nodesCount consecutive nodes starting from firstNodeID*/
+int readNodesFromFile(int btreefd, unsigned int firstNodeID, unsigned int nodesCount, BTreeNode_t *nodes)
+{
+	size_t total=(size_t)nodesCount*sizeof(BTreeNode_t);
+	size_t done=0;
+	off_t offset=getNodeOffset(firstNodeID);
+	ssize_t res;
+
+	while(done<total)
 	{
-		fseek(btreefile, max_move*sizeof(BTreeNode_t), SEEK_CUR);
-		remainder-=max_move;
+		res=pread(btreefd,(char *)nodes+done,total-done,offset+done);
+		if(res<=0)
+		{
+			if(res<0 && errno==EINTR)
+				continue;
+			printf("error reading nodes %u-%u from BTree file: %s\n",firstNodeID,
+				firstNodeID+nodesCount-1,res<0 ? strerror(errno) : "unexpected end of file");
+			return RESULT_ERROR;
+		}
+		done+=res;
 	}
+	return 0;
+}
 
-	fseek(btreefile, (int)remainder*sizeof(BTreeNode_t), SEEK_CUR);
+/*writes the node into its place in BTree file, which is determined by its nodeID*/
+int writeNodeToFile(int btreefd, BTreeNode_t *node)
+{
+	size_t total=sizeof(BTreeNode_t);
+	size_t done=0;
+	off_t offset=getNodeOffset(node->header.nodeID);
+	ssize_t res;
+
+	while(done<total)
+	{
+		res=pwrite(btreefd,(char *)node+done,total-done,offset+done);
+		if(res<=0)
+		{
+			if(res<0 && errno==EINTR)
+				continue;
+			printf("error writing node %u to BTree file: %s\n",node->header.nodeID,
+				res<0 ? strerror(errno) : "no bytes were written");
+			return RESULT_ERROR;
+		}
+		done+=res;
+	}
 	return 0;
 }
\ No newline at end of file
@@ -1,10 +1,14 @@
 #include "general.h"
+#include <string.h>
 /**
 That is where the whole idea of dynamic buffer is implemented
 Each word is first added to a in-mem buffer, organized as a set of buckets.
 
 Each bucket is a leaf in a keyword tree.
 
+Keys are appended to the end of the bucket, and the bucket is sorted only when the order is needed:
+before it splits and before it is transferred.
+
 Once it is full, the bucket can split (still in memory).
 
 When the total number of buckets which can be held in memory is exhausted,
@@ -13,6 +17,9 @@ By the cost of almost one random disk I/O.
 */
 extern int transfercounter;
 
+#define BUCKET_RADIX_BITS 8
+#define BUCKET_RADIX_SIZE (1<<BUCKET_RADIX_BITS)
+
 //starting point
 int insertKeyIntoBuffer(unsigned int key, unsigned int docID, 
                     Buffer_t *buffer, SystemState_t *state) {
@@ -38,22 +45,67 @@ int insertKeyIntoBuffer(unsigned int key, unsigned int docID,
 }
 
 
-int initBuffer(Buffer_t *buffer) {
+/*
+memory of one bucket with its share of the top tree (2 nodes per bucket) and of the eviction heap:
+the number of buckets in a memory budget is the budget divided by this
+*/
+static size_t getBucketMemory(int keysPerBucket) {
+	return keysPerBucket*sizeof(Data_t)+sizeof(Bucket_t)+sizeof(int)
+		+2*(sizeof(TopTreeNode_t)+3*sizeof(int)+sizeof(short));
+}
+
+/*
+creates the buffer with as many buckets of keysPerBucket keys as fit into memoryBytes,
+or with DEFAULT_NUMBER_OF_BUCKETS buckets if memoryBytes is 0
+*/
+int initBuffer(Buffer_t *buffer, size_t memoryBytes, int keysPerBucket) {
 	Bucket_t *buckets;
+	TopTreeHeader_t *header=&buffer->tree.header;
+	EvictionHeap_t *candidates=&buffer->candidates;
+	size_t bucketsCount;
+	int i;
 
-    buckets=(Bucket_t*) calloc (MAX_NUMBER_OF_BUCKETS, sizeof(Bucket_t));
-	if(buckets==NULL)	{
-		printf("Failed to allocate memory for %d buckets\n",
-			MAX_NUMBER_OF_BUCKETS);
+	if(keysPerBucket<2)	{
+		printf("A bucket should hold at least 2 keys, not %d\n",keysPerBucket);
+		return RESULT_ERROR;
+	}
+	bucketsCount=(memoryBytes==0) ? DEFAULT_NUMBER_OF_BUCKETS : memoryBytes/getBucketMemory(keysPerBucket);
+	if(bucketsCount<MIN_NUMBER_OF_BUCKETS || bucketsCount>MAX_NUMBER_OF_BUCKETS)	{
+		printf("Buffer of %lu MB holds %lu buckets of %d keys, expected from %d to %d buckets\n",
+			(unsigned long)(memoryBytes>>20),(unsigned long)bucketsCount,keysPerBucket,MIN_NUMBER_OF_BUCKETS,MAX_NUMBER_OF_BUCKETS);
+		return RESULT_ERROR;
+	}
+	header->maxBucketsCount=(int)bucketsCount;
+	header->keysPerBucket=keysPerBucket;
+	header->maxNodesCount=2*header->maxBucketsCount;
+
+    buckets=(Bucket_t*) calloc (header->maxBucketsCount, sizeof(Bucket_t));
+	buffer->keys=(Data_t*) calloc ((size_t)header->maxBucketsCount*keysPerBucket, sizeof(Data_t));
+	buffer->sortScratch=(Data_t*) calloc (keysPerBucket, sizeof(Data_t));
+	buffer->tree.nodes=(TopTreeNode_t*) calloc (header->maxNodesCount, sizeof(TopTreeNode_t));
+	candidates->heap=(int*) calloc (header->maxNodesCount, sizeof(int));
+	candidates->heapPos=(int*) calloc (header->maxNodesCount, sizeof(int));
+	candidates->depth=(short*) calloc (header->maxNodesCount, sizeof(short));
+	candidates->nodeParent=(int*) calloc (header->maxNodesCount, sizeof(int));
+	candidates->bucketParent=(int*) calloc (header->maxBucketsCount, sizeof(int));
+	if(buckets==NULL || buffer->keys==NULL || buffer->sortScratch==NULL || buffer->tree.nodes==NULL
+		|| candidates->heap==NULL || candidates->heapPos==NULL || candidates->depth==NULL
+		|| candidates->nodeParent==NULL || candidates->bucketParent==NULL)	{
+		printf("Failed to allocate memory for %d buckets of %d keys\n",
+			header->maxBucketsCount,keysPerBucket);
 		return RESULT_ERROR;
 	}
 
 	buffer->buckets=buckets;
+	for(i=0;i<header->maxBucketsCount;i++)
+		buckets[i].data=&buffer->keys[(size_t)i*keysPerBucket];
+
 	buffer->currentTreeLevel=0;
-	buffer->tree.header.bucketsCounter=1;
-	buffer->tree.header.freeBucketID=0;
-	buffer->tree.header.nodesCounter=1;
-	buffer->tree.header.freeNodePos=0;
+	buffer->lastPathValid=FALSE;
+	header->bucketsCounter=1;
+	header->freeBucketID=0;
+	header->nodesCounter=1;
+	header->freeNodePos=0;
 
 	buffer->tree.nodes[0].children[0]=0; //root node
 	buffer->tree.nodes[0].children[1]=0;
@@ -62,23 +114,29 @@ int initBuffer(Buffer_t *buffer) {
 
 	buffer->buckets[1].header.keysCount=0;
 	buffer->buckets[1].header.LCPinBits=NUM_BITS_INUINT;
+
+	candidates->count=0;
+	for(i=0;i<header->maxNodesCount;i++)
+		candidates->heapPos[i]=-1;
+	candidates->depth[0]=0;
+	candidates->nodeParent[0]=0;
 	
+	printf("Buffer has %d buckets of %d keys, %lu MB\n",header->maxBucketsCount,keysPerBucket,
+		(unsigned long)((header->maxBucketsCount*getBucketMemory(keysPerBucket))>>20));
 	return RESULT_OK;
 }
 
 int traverseAndWriteBucketsToBTree(TopTreeNode_t *parent,Buffer_t *buffer,
                                                     SystemState_t *state) {
-	int i,bucketID;
+	int bucketID;
 	Bucket_t *bucket;
 	if(parent->children[0]!=0)	{
 		if(parent->children[0]<0)	{
 			bucketID=-(parent->children[0]);
 			bucket=&buffer->buckets[bucketID];
 
-			for(i=0;i<bucket->header.keysCount;i++)	{
-				if(insertSortedKeyFromBuffer(state, bucket->data[i].value,bucket->data[i].pointer))
-					exit(1);				
-			}
+			if(writeBucketToBTree(state, buffer, bucket))
+				exit(1);
             transfercounter++;
 		}
 		else {//internal node		
@@ -91,11 +149,8 @@ int traverseAndWriteBucketsToBTree(TopTreeNode_t *parent,Buffer_t *buffer,
 			bucketID=-(parent->children[1]);
 			bucket=&buffer->buckets[bucketID];
 
-			for(i=0;i<bucket->header.keysCount;i++)	{
-				if(insertSortedKeyFromBuffer(state, bucket->data[i].value,
-					bucket->data[i].pointer))
-					exit(1);				
-			}
+			if(writeBucketToBTree(state, buffer, bucket))
+				exit(1);
             transfercounter++;
 		}
 		else {//internal node
@@ -108,7 +163,7 @@ int traverseAndWriteBucketsToBTree(TopTreeNode_t *parent,Buffer_t *buffer,
 
 // empty all buckets into BTree - by traversals
 int synchronizeBuffer(Buffer_t *buffer,SystemState_t *state ) {
-	int i,bucketID;
+	int bucketID;
 	Bucket_t *bucket;
 	TopTreeNode_t *root=&(buffer->tree.nodes[0]);
 
@@ -117,10 +172,8 @@ int synchronizeBuffer(Buffer_t *buffer,SystemState_t *state ) {
 			bucketID=-(root->children[0]);
 			bucket=&buffer->buckets[bucketID];
 
-			for(i=0;i<bucket->header.keysCount;i++)	{
-				if(insertSortedKeyFromBuffer(state, bucket->data[i].value,bucket->data[i].pointer))
-					exit(1);				
-			}
+			if(writeBucketToBTree(state, buffer, bucket))
+				exit(1);
             transfercounter++;
 		}
 		else { //internal node
@@ -133,10 +186,8 @@ int synchronizeBuffer(Buffer_t *buffer,SystemState_t *state ) {
 			bucketID=-(root->children[1]);
 			bucket=&buffer->buckets[bucketID];
 
-			for(i=0;i<bucket->header.keysCount;i++)	{
-				if(insertSortedKeyFromBuffer(state, bucket->data[i].value,bucket->data[i].pointer))
-					exit(1);				
-			}
+			if(writeBucketToBTree(state, buffer, bucket))
+				exit(1);
             transfercounter++;
 		}
 		else { //internal node
@@ -172,19 +223,34 @@ int findBucketForKey(unsigned int key, Buffer_t *buffer, SystemState_t *state) {
 	int ID;
 	int lcp;
 	int treenodeID;
+	int nodeID;
+	int childID;
 	char bit1, bit2;
 	Bucket_t *bucket;
-
-	buffer->currentTreeLevel=0;
-
-	buffer->lastPath[0].node=&buffer->tree.nodes[0];
-	buffer->lastPath[0].nodeID=0;
-	buffer->lastPath[0].whatChild=getBit(&key,0);
+	EvictionHeap_t *candidates=&buffer->candidates;
+
+	//keys of a document come in order: the path of the previous key is reused up to their LCP
+	if(buffer->lastPathValid==TRUE)
+		buffer->currentTreeLevel=searchUpInTree(buffer,getLCP(&buffer->lastKey,&key));
+	else
+		buffer->currentTreeLevel=0;
+	buffer->lastPathValid=FALSE;
+
+	if(buffer->currentTreeLevel>0)	{
+		distanceFromRoot=candidates->depth[buffer->lastPath[buffer->currentTreeLevel].nodeID];
+		buffer->lastPath[buffer->currentTreeLevel].whatChild=getBit(&key,distanceFromRoot);
+	}
+	else {
+		buffer->lastPath[0].node=&buffer->tree.nodes[0];
+		buffer->lastPath[0].nodeID=0;
+		buffer->lastPath[0].whatChild=getBit(&key,0);
+	}
 
 	//first time insertion to a new bucket as a child of a root
-	if(buffer->tree.nodes[0].children[(size_t)buffer->lastPath[0].whatChild]==0) {
+	if(buffer->currentTreeLevel==0 && buffer->tree.nodes[0].children[(size_t)buffer->lastPath[0].whatChild]==0) {
 		ID=getFreeBucketID(buffer,state);
 		buffer->tree.nodes[0].children[(size_t) buffer->lastPath[0].whatChild]=-ID;
+		candidates->bucketParent[ID]=0;
 		return ID;
 	}
 
@@ -199,19 +265,25 @@ int findBucketForKey(unsigned int key, Buffer_t *buffer, SystemState_t *state) {
 	//verify that the bucket is correct
 	bucket=&buffer->buckets[-ID];
 
-	if(bucket->header.keysCount==0)  //this happens if the split was required higher in the tree in the prev step and created a new bucket for this specific key
+	if(bucket->header.keysCount==0)	{  //this happens if the split was required higher in the tree in the prev step and created a new bucket for this specific key
+		buffer->lastKey=key;
+		buffer->lastPathValid=TRUE;
 		return -ID;
+	}
 	
 	lcp=getLCPwithBitsAfterLCP(&key,&(bucket->data[0].value),&bit1,&bit2);
 	
 	
 	if(distanceFromRoot==0 || lcp>=distanceFromRoot+1) { //child of root node or belongs to this buffer
 		//verify that the bucket has space
-		if(bucket->header.keysCount<MAX_KEYS_PER_BUCKET)
+		if(bucket->header.keysCount<buffer->tree.header.keysPerBucket)	{
+			buffer->lastKey=key;
+			buffer->lastPathValid=TRUE;
 			return -ID;
+		}
 		else {
 			if(buffer->tree.header.freeBucketID>0 
-                || buffer->tree.header.bucketsCounter<MAX_NUMBER_OF_BUCKETS) {
+                || buffer->tree.header.bucketsCounter<buffer->tree.header.maxBucketsCount) {
 				if(splitBucket(state, buffer,(-ID),distanceFromRoot)==RESULT_ERROR)	{
 					printf("error splitting bucket\n");
 					return RESULT_ERROR;
@@ -249,6 +321,22 @@ int findBucketForKey(unsigned int key, Buffer_t *buffer, SystemState_t *state) {
 
 			buffer->lastPath[buffer->currentTreeLevel].node->children[(size_t)bit1]=-ID;
 			buffer->lastPath[buffer->currentTreeLevel].node->children[(size_t)bit2]=treenodeID;
+
+			//the new node takes the children of the old one and its depth, the old node is now lcp bits deep
+			nodeID=buffer->lastPath[buffer->currentTreeLevel].nodeID;
+			candidates->depth[treenodeID]=distanceFromRoot;
+			candidates->depth[nodeID]=lcp;
+			candidates->nodeParent[treenodeID]=nodeID;
+			candidates->bucketParent[ID]=nodeID;
+			for(i=0;i<2;i++) {
+				childID=buffer->tree.nodes[treenodeID].children[i];
+				if(childID<0)
+					candidates->bucketParent[-childID]=treenodeID;
+				else if(childID>0)
+					candidates->nodeParent[childID]=treenodeID;
+			}
+			updateEvictionCandidate(buffer,nodeID);
+			updateEvictionCandidate(buffer,treenodeID);
 			return ID;
 		}
 		else { //need to empty one bucket
@@ -261,6 +349,19 @@ int findBucketForKey(unsigned int key, Buffer_t *buffer, SystemState_t *state) {
 	}	
 }
 
+/*
+moves up in lastPath of the previous key to the deepest node which branches on a bit inside the LCP
+of the previous and the current key: both keys follow the same path down to this node.
+Returns the level of the node, 0 - the search starts from the root
+*/
+int searchUpInTree(Buffer_t *buffer, int lcp) {
+	int level=buffer->currentTreeLevel;
+
+	while(level>0 && buffer->candidates.depth[buffer->lastPath[level].nodeID]>=lcp)
+		level--;
+	return level;
+}
+
 //moves up in lastPath to find the split point for a given LCP obtained after verification
 int moveUpInTree(int *distanceFromRoot, Buffer_t *buffer, int lcp) {
 	if(lcp>(*distanceFromRoot - buffer->lastPath[buffer->currentTreeLevel].node->incomingEdgeLength))
@@ -281,15 +382,17 @@ int getFreeBucketID(Buffer_t *buffer, SystemState_t *state) {
 	if(id>0) {
 		buffer->buckets[id].header.keysCount=0;
 		buffer->buckets[id].header.LCPinBits=NUM_BITS_INUINT;
+		buffer->buckets[id].header.sortedCount=0;
 		
 		buffer->tree.header.freeBucketID=0;
 		return id;
 	}
 
 	id=buffer->tree.header.bucketsCounter;
-	if(id<MAX_NUMBER_OF_BUCKETS) {
+	if(id<buffer->tree.header.maxBucketsCount) {
 		buffer->buckets[id].header.keysCount=0;
 		buffer->buckets[id].header.LCPinBits=NUM_BITS_INUINT;
+		buffer->buckets[id].header.sortedCount=0;
 	
 		buffer->tree.header.bucketsCounter++;
 		return id;  
@@ -316,7 +419,7 @@ int getFreeNodeID(Buffer_t *buffer) {
 
 		
 	id=buffer->tree.header.nodesCounter;
-	if(id<MAX_TOP_TREE_NODES)	{
+	if(id<buffer->tree.header.maxNodesCount)	{
 		buffer->tree.nodes[id].children[0]=0;
 		buffer->tree.nodes[id].children[1]=0;
 		
@@ -330,16 +433,15 @@ int getFreeNodeID(Buffer_t *buffer) {
 
 int splitBucket(SystemState_t *state,Buffer_t *buffer,
                 int bucketID, int parentDistanceFromRoot) {
-	int i,j;
 	Bucket_t *bucket;
 	
 	int lcp;
 	int newBucketID;
 	Bucket_t *newBucket;
-	int bitAfterLCP;
+	int splitPos;
+	int low, high, middle;
 	
 	int newLCP, prevLCP;
-	int tmp;
 
 	TopTreeNode_t *parentNode;
 	TopTreeNode_t *splitNode;
@@ -352,20 +454,21 @@ int splitBucket(SystemState_t *state,Buffer_t *buffer,
 	//all keys in this bucket are equal - 
     //we transfer to BTree all except 1 - in order to not to change the tree yet
 	if(bucket->header.LCPinBits==NUM_BITS_INUINT) {
-		for(i=1;i<bucket->header.keysCount;i++)	{
-			if(insertSortedKeyFromBuffer(state, bucket->data[i].value, 
-                                            bucket->data[i].pointer)==RESULT_ERROR)	{
-				printf("equal keys insertion failed during split\n");
-				return RESULT_ERROR;
-			}
+		if(insertSortedBatchFromBuffer(state, &bucket->data[1], 
+                                        bucket->header.keysCount-1)==RESULT_ERROR)	{
+			printf("equal keys insertion failed during split\n");
+			return RESULT_ERROR;
 		}
 
 		bucket->header.keysCount=1;
+		bucket->header.sortedCount=1;
 		resetBTreePath(state);
+		updateEvictionCandidate(buffer,buffer->candidates.bucketParent[bucketID]);
 		return RESULT_OK;
 	}
 
 
+	sortBucket(buffer, bucket);
 	lcp=bucket->header.LCPinBits;
 	newBucketID=getFreeBucketID(buffer, state);
 	//cannot happen that there are no free buckets, since we tested it before calling split
@@ -373,50 +476,39 @@ int splitBucket(SystemState_t *state,Buffer_t *buffer,
 	newBucket=&buffer->buckets[newBucketID];
 	
 	//we split based on the bit after LCP
-	//it should be at least 1 key which differs by this bit, since 
+	//all keys share the first lcp bits and are sorted, so the keys with 0 after LCP go first.
+	//There is at least 1 key with each bit, since 
 	//othervise the LCP would be NUM_BITS_INUINT - all keys would have been equal
-	bitAfterLCP=0;
-		
-	newLCP=NUM_BITS_INUINT; //set max possible
-
-	for(i=0;i<bucket->header.keysCount && bitAfterLCP==0;i++)	{
-		bitAfterLCP=getBit(&(bucket->data[i].value),lcp); //lcp is 1 bigger than the position
-		if(bitAfterLCP!=0)	{
-			i--;
-		}
-		else {
-			newBucket->data[i]=bucket->data[i];
-			(newBucket->header.keysCount)++;
-		
-			if(i>0)	{
-				tmp=getLCP(&(newBucket->data[i-1].value),&(newBucket->data[i].value));					
-				if(tmp<newLCP)
-					newLCP=tmp;
-			}
-		}
+	low=1; //bit of the first key is 0
+	high=bucket->header.keysCount-1; //bit of the last key is 1
+	while(low<high)	{
+		middle=(low+high)/2;
+		if(getBit(&(bucket->data[middle].value),lcp)) //lcp is 1 bigger than the position
+			high=middle;
+		else
+			low=middle+1;
 	}
-	
+	splitPos=low;
+
+	//keys with 0 move to the new bucket
+	memcpy(newBucket->data,bucket->data,splitPos*sizeof(Data_t));
+	newBucket->header.keysCount=splitPos;
+	newBucket->header.sortedCount=splitPos;
+
+	//in a sorted bucket LCP of all keys is the LCP of the first and the last key
+	newLCP=getLCP(&(newBucket->data[0].value),&(newBucket->data[splitPos-1].value));
 	newBucket->header.LCPinBits=newLCP;
 	if(newLCP<=prevLCP)	{
 		printf("Logic error - split bucket - new LCP %d <= prevLCP %d in new bucket\n",newLCP,prevLCP);
 		exit(1);
 	}
 	
-	//update with the new key order in the old bucket	
-	newLCP=NUM_BITS_INUINT;	
+	//keys with 1 stay in the old bucket
+	memmove(bucket->data,&(bucket->data[splitPos]),(bucket->header.keysCount-splitPos)*sizeof(Data_t));
+	bucket->header.keysCount-=splitPos;
+	bucket->header.sortedCount=bucket->header.keysCount;
 
-	for(j=0;i<bucket->header.keysCount;i++,j++)	{
-		bucket->data[j]=bucket->data[i];
-		
-		if(j>0)	{
-			tmp=getLCP(&(bucket->data[j-1].value),&(bucket->data[j].value));
-			
-			if(tmp<newLCP)
-				newLCP=tmp;
-		}
-	}
-	bucket->header.keysCount=j;
-		
+	newLCP=getLCP(&(bucket->data[0].value),&(bucket->data[bucket->header.keysCount-1].value));
 	bucket->header.LCPinBits=newLCP;
 	if(newLCP<=prevLCP)	{
 		printf("Logic error - split bucket - new LCP %d <= prevLCP %d in old bucket\n",newLCP,prevLCP);
@@ -434,62 +526,127 @@ int splitBucket(SystemState_t *state,Buffer_t *buffer,
 	splitNode->incomingEdgeLength=prevLCP-parentDistanceFromRoot;
 	splitNode->children[0]=-newBucketID;
 	splitNode->children[1]=-bucketID;
+
+	buffer->candidates.depth[newNodeID]=prevLCP;
+	buffer->candidates.nodeParent[newNodeID]=buffer->lastPath[buffer->currentTreeLevel].nodeID;
+	buffer->candidates.bucketParent[newBucketID]=newNodeID;
+	buffer->candidates.bucketParent[bucketID]=newNodeID;
+	updateEvictionCandidate(buffer,buffer->lastPath[buffer->currentTreeLevel].nodeID);
+	updateEvictionCandidate(buffer,newNodeID);
 	return RESULT_OK;
 }
 
-void traverseForDeepestInternalNode(Buffer_t *buffer, int distanceFromRoot, 
-                                        int maxLCP, TopTreeNode_t *currParent) {
-	TopTreeNode_t *currChild;
+/*
+order of two eviction candidates: the deeper node goes first, 
+and of two nodes of the same depth - the node with more keys in its buckets.
+Returns a positive number if the first node goes first
+*/
+static int compareCandidates(Buffer_t *buffer, int firstID, int secondID) {
+	TopTreeNode_t *first=&buffer->tree.nodes[firstID];
+	TopTreeNode_t *second=&buffer->tree.nodes[secondID];
+
+	if(buffer->candidates.depth[firstID]!=buffer->candidates.depth[secondID])
+		return buffer->candidates.depth[firstID]-buffer->candidates.depth[secondID];
+	return buffer->buckets[-first->children[0]].header.keysCount+buffer->buckets[-first->children[1]].header.keysCount
+		-buffer->buckets[-second->children[0]].header.keysCount-buffer->buckets[-second->children[1]].header.keysCount;
+}
 
-	if(currParent->children[0]<0 && currParent->children[1]<0)
-		return;
-	
-	if(currParent->children[0]>0) {	
-		currChild=&(buffer->tree.nodes[currParent->children[0]]);
+static void swapCandidates(EvictionHeap_t *candidates, int i, int j) {
+	int nodeID=candidates->heap[i];
 
-		if(distanceFromRoot+currChild->incomingEdgeLength>maxLCP) {
-			maxLCP=distanceFromRoot+currChild->incomingEdgeLength;
-			buffer->parentOfDeepestBucket.node=currParent;
-			buffer->parentOfDeepestBucket.whatChild=0;
-		}
-		distanceFromRoot+=currChild->incomingEdgeLength;
-		traverseForDeepestInternalNode(buffer, distanceFromRoot, maxLCP, currChild);
+	candidates->heap[i]=candidates->heap[j];
+	candidates->heap[j]=nodeID;
+	candidates->heapPos[candidates->heap[i]]=i;
+	candidates->heapPos[candidates->heap[j]]=j;
+}
+
+static void siftCandidateUp(Buffer_t *buffer, int pos) {
+	EvictionHeap_t *candidates=&buffer->candidates;
+
+	while(pos>0 && compareCandidates(buffer,candidates->heap[pos],candidates->heap[(pos-1)/2])>0) {
+		swapCandidates(candidates,pos,(pos-1)/2);
+		pos=(pos-1)/2;
 	}
+}
 
-	if(currParent->children[1]>0) {	
-		currChild=&(buffer->tree.nodes[currParent->children[1]]);
+static void siftCandidateDown(Buffer_t *buffer, int pos) {
+	EvictionHeap_t *candidates=&buffer->candidates;
+	int largest,child;
 
-		if(distanceFromRoot+currChild->incomingEdgeLength>maxLCP) {
-			maxLCP=distanceFromRoot+currChild->incomingEdgeLength;
-			buffer->parentOfDeepestBucket.node=currParent;
-			buffer->parentOfDeepestBucket.whatChild=1;
+	for(;;) {
+		largest=pos;
+		for(child=2*pos+1;child<=2*pos+2 && child<candidates->count;child++) {
+			if(compareCandidates(buffer,candidates->heap[child],candidates->heap[largest])>0)
+				largest=child;
 		}
-		distanceFromRoot+=currChild->incomingEdgeLength;
-		traverseForDeepestInternalNode(buffer, distanceFromRoot, maxLCP, currChild);
+		if(largest==pos)
+			return;
+		swapCandidates(candidates,pos,largest);
+		pos=largest;
+	}
+}
+
+/*
+puts the top tree node into the heap of eviction candidates, moves it to its new place,
+or removes it from the heap - after its children or the sizes of their buckets changed.
+The root is never a candidate: it cannot be replaced by one of its buckets
+*/
+void updateEvictionCandidate(Buffer_t *buffer, int nodeID) {
+	EvictionHeap_t *candidates=&buffer->candidates;
+	TopTreeNode_t *node=&buffer->tree.nodes[nodeID];
+	int pos=candidates->heapPos[nodeID];
+	int movedID;
+
+	if(nodeID==0)
+		return;
+
+	if(node->children[0]>=0 || node->children[1]>=0) {
+		if(pos<0)
+			return;
+		//the last candidate takes the place of the removed one
+		candidates->heapPos[nodeID]=-1;
+		candidates->count--;
+		if(pos==candidates->count)
+			return;
+		movedID=candidates->heap[candidates->count];
+		candidates->heap[pos]=movedID;
+		candidates->heapPos[movedID]=pos;
+		siftCandidateUp(buffer,pos);
+		siftCandidateDown(buffer,candidates->heapPos[movedID]);
+		return;
+	}
+
+	if(pos<0) {
+		pos=candidates->count++;
+		candidates->heap[pos]=nodeID;
+		candidates->heapPos[nodeID]=pos;
 	}
+	siftCandidateUp(buffer,pos);
+	siftCandidateDown(buffer,candidates->heapPos[nodeID]);
 }
 
 int transferOneBucketToBTree(Buffer_t *buffer,SystemState_t *state)  { //also performs delete operation in the tree
-	int i;
-	int maxLCP=0;
-	TopTreeNode_t *tree_root;
-	int distanceFromRoot=0;
+	EvictionHeap_t *candidates=&buffer->candidates;
 	TopTreeNode_t *parent;
 	TopTreeNode_t *internalChild;
 	Bucket_t *bucket;	
+	int internalChildID;
+	int parentID;
+	int whatChild;
 	int bucketID;	
 	int remainingBucketID;	
 
-	tree_root=&(buffer->tree.nodes[0]);	
-	
-	traverseForDeepestInternalNode(buffer,distanceFromRoot,maxLCP,tree_root);
-
-	//after this the child of buffer->parentOfDeepestBucket contains the parent of some deepest internal node
-	parent=buffer->parentOfDeepestBucket.node;
-	internalChild=&(buffer->tree.nodes[parent->children[(size_t)buffer->parentOfDeepestBucket.whatChild]]);
+	if(candidates->count==0) {
+		printf("No pair of sibling buckets to transfer one of them to btree\n");
+		return RESULT_ERROR;
+	}
 
-	//both children of this internal node are buckets
-	//since otherwise the maxlcp would go deeper
+	//the deepest internal node whose both children are buckets
+	internalChildID=candidates->heap[0];
+	internalChild=&(buffer->tree.nodes[internalChildID]);
+	parentID=candidates->nodeParent[internalChildID];
+	parent=&(buffer->tree.nodes[parentID]);
+	whatChild=(parent->children[1]==internalChildID) ? 1 : 0;
 	
 	if(buffer->buckets[-internalChild->children[0]].header.keysCount
                     > buffer->buckets[-internalChild->children[1]].header.keysCount) {
@@ -503,12 +660,9 @@ int transferOneBucketToBTree(Buffer_t *buffer,SystemState_t *state)  { //also pe
 
 	bucket=&(buffer->buckets[bucketID]);
 	
-	for(i=0;i<bucket->header.keysCount;i++)	{
-		if(insertSortedKeyFromBuffer(state, bucket->data[i].value, bucket->data[i].pointer)
-                                                                                ==RESULT_ERROR)	{
-			printf("Failed to insert keys from buffer during transferOneBuckettoBTree\n");
-			return RESULT_ERROR;
-		}
+	if(writeBucketToBTree(state, buffer, bucket)==RESULT_ERROR)	{
+		printf("Failed to insert keys from buffer during transferOneBuckettoBTree\n");
+		return RESULT_ERROR;
 	}
 
 	bucket->header.keysCount=0;
@@ -517,57 +671,159 @@ int transferOneBucketToBTree(Buffer_t *buffer,SystemState_t *state)  { //also pe
 
 	// update top tree - just remove internal node
 	// at most 1 internal node is removed - his pos in the array can be reused
-	buffer->tree.header.freeNodePos=parent->children[(size_t)buffer->parentOfDeepestBucket.whatChild];
-	parent->children[(size_t)buffer->parentOfDeepestBucket.whatChild]=-remainingBucketID;	
+	buffer->tree.header.freeNodePos=internalChildID;
+	parent->children[whatChild]=-remainingBucketID;	
+	internalChild->children[0]=0;
+	internalChild->children[1]=0;
+	candidates->bucketParent[remainingBucketID]=parentID;
+	updateEvictionCandidate(buffer,internalChildID);
+	updateEvictionCandidate(buffer,parentID);
     transfercounter++;
 	return RESULT_OK;
 }
 
+//inserts all keys of a bucket into BTree in one sorted batch.
+//the B-tree nodes covering the bucket key range are read in advance, all together
+int writeBucketToBTree(SystemState_t *state, Buffer_t *buffer, Bucket_t *bucket) {
+	unsigned int minKey, maxKey;
+
+	if(bucket->header.keysCount==0)
+		return RESULT_OK;
+
+	sortBucket(buffer, bucket);
+	minKey=bucket->data[0].value;
+	maxKey=bucket->data[bucket->header.keysCount-1].value;
+	if(prefetchKeyRange(state, minKey, maxKey))	{
+		printf("Failed to read B-tree nodes of key range %u-%u\n",minKey,maxKey);
+		return RESULT_ERROR;
+	}
+
+	if(insertSortedBatchFromBuffer(state, bucket->data, bucket->header.keysCount))
+		return RESULT_ERROR;
+	return RESULT_OK;
+}
+
+/*
+appends the key to the end of the bucket.
+The LCP of all keys of the bucket is the shortest LCP of a key with the first key, whatever the order of keys
+*/
 int addKeyToBucket(Buffer_t *buffer, int bucketID, unsigned int key, unsigned int docID) {
-	int i,j, newLCP;
+	int newLCP;
 	Bucket_t *bucket;
+	int count;
 	
 	bucket=&buffer->buckets[bucketID];
-	
-	for(i=0;i<bucket->header.keysCount;i++)	{
-		if(bucket->data[i].value>=key)
-		{
-			newLCP=getLCP(&(bucket->data[i].value), &key);
-			//move pointers
-			for(j=bucket->header.keysCount;j>i;j--)	{
-				bucket->data[j]=bucket->data[j-1];
-			}
-			//add key pointer to be stored
-			bucket->data[i].value=key;
-			bucket->data[i].pointer=docID;
-		
-			//update key count
-			bucket->header.keysCount++;
-			
-			//update lcp
-			if(newLCP<bucket->header.LCPinBits)
-				bucket->header.LCPinBits=newLCP;
-	
-			return RESULT_OK;
-		}
-	}	
-
-	//add to the end of the bucket
-	bucket->data[i].value=key;
-	bucket->data[i].pointer=docID;
-	
-	//update key count
-	bucket->header.keysCount++;
+	count=bucket->header.keysCount;
 
-	if(bucket->header.keysCount==1)
+	if(count==0)	{
 		bucket->header.LCPinBits=NUM_BITS_INUINT;
+		bucket->header.sortedCount=0;
+	}
 	else {
-		newLCP=getLCP(&key, &(bucket->data[bucket->header.keysCount-2].value));
+		newLCP=getLCP(&key, &(bucket->data[0].value));
 		if(newLCP<bucket->header.LCPinBits)
 			bucket->header.LCPinBits=newLCP;
 	}
+
+	//the keys stay in order while every new key is not smaller than the last one
+	if(bucket->header.sortedCount==count && (count==0 || bucket->data[count-1].value<=key))
+		bucket->header.sortedCount++;
+
+	bucket->data[count].value=key;
+	bucket->data[count].pointer=docID;
+	bucket->header.keysCount++;
 	
+	updateEvictionCandidate(buffer,buffer->candidates.bucketParent[bucketID]);
 	return RESULT_OK;
 }
 
+/*
+sorts the keys of the bucket with a stable LSD radix sort, BUCKET_RADIX_BITS bits per pass,
+so the documents of the same key stay in arrival order.
+A pass is skipped when all keys have the same digit - e.g. for the digits inside the LCP of the bucket
+*/
+void sortBucket(Buffer_t *buffer, Bucket_t *bucket) {
+	int count[NUM_BITS_INUINT/BUCKET_RADIX_BITS][BUCKET_RADIX_SIZE];
+	int keysCount=bucket->header.keysCount;
+	Data_t *from=bucket->data;
+	Data_t *to=buffer->sortScratch;
+	Data_t *tmp;
+	int pass,i,pos,digitCount;
+	unsigned int digit;
+
+	if(bucket->header.sortedCount>=keysCount)
+		return;
+
+	memset(count,0,sizeof(count));
+	for(i=0;i<keysCount;i++)	{
+		for(pass=0;pass<NUM_BITS_INUINT/BUCKET_RADIX_BITS;pass++)	{
+			digit=(from[i].value>>(pass*BUCKET_RADIX_BITS))&(BUCKET_RADIX_SIZE-1);
+			count[pass][digit]++;
+		}
+	}
+
+	for(pass=0;pass<NUM_BITS_INUINT/BUCKET_RADIX_BITS;pass++)	{
+		digit=(from[0].value>>(pass*BUCKET_RADIX_BITS))&(BUCKET_RADIX_SIZE-1);
+		if(count[pass][digit]==keysCount)
+			continue;
+
+		//counts become start positions of the digits
+		for(pos=0,i=0;i<BUCKET_RADIX_SIZE;i++)	{
+			digitCount=count[pass][i];
+			count[pass][i]=pos;
+			pos+=digitCount;
+		}
+		for(i=0;i<keysCount;i++)	{
+			digit=(from[i].value>>(pass*BUCKET_RADIX_BITS))&(BUCKET_RADIX_SIZE-1);
+			to[count[pass][digit]++]=from[i];
+		}
+		tmp=from;
+		from=to;
+		to=tmp;
+	}
+
+	if(from!=bucket->data)
+		memcpy(bucket->data,from,keysCount*sizeof(Data_t));
+	bucket->header.sortedCount=keysCount;
+}
+
+//sorts all buckets, before the buffer is written to a file
+void sortBufferBuckets(Buffer_t *buffer) {
+	int i;
+
+	for(i=1;i<buffer->tree.header.bucketsCounter;i++)
+		sortBucket(buffer, &buffer->buckets[i]);
+}
+
+/*
+writes the buffer to a file: the top tree header with the buffer geometry, the used top tree nodes,
+the headers of the used buckets and then the keys of each bucket, sorted
+*/
+int serializeBuffer(Buffer_t *buffer, FILE *file) {
+	TopTreeHeader_t *header=&buffer->tree.header;
+	Bucket_t *bucket;
+	int i;
 
+	sortBufferBuckets(buffer);
+	if(fwrite(header,sizeof(TopTreeHeader_t),1,file)!=1
+		|| fwrite(buffer->tree.nodes,sizeof(TopTreeNode_t),header->nodesCounter,file)!=(size_t)header->nodesCounter)	{
+		printf("failed to serialize buffer top tree\n");
+		return RESULT_ERROR;
+	}
+
+	for(i=0;i<header->bucketsCounter;i++)	{
+		if(fwrite(&buffer->buckets[i].header,sizeof(BucketHeader_t),1,file)!=1)	{
+			printf("failed to serialize header of bucket %d\n",i);
+			return RESULT_ERROR;
+		}
+	}
+
+	for(i=0;i<header->bucketsCounter;i++)	{
+		bucket=&buffer->buckets[i];
+		if(fwrite(bucket->data,sizeof(Data_t),bucket->header.keysCount,file)!=(size_t)bucket->header.keysCount)	{
+			printf("failed to serialize keys of bucket %d\n",i);
+			return RESULT_ERROR;
+		}
+	}
+	return RESULT_OK;
+}
@@ -29,7 +29,16 @@ enum BOOL {FALSE, TRUE};
 //------------------
 
 //-----------btree enums
-enum node_t{ ROOT, INTERNAL,	LEAF};
+enum node_t{ ROOT, INTERNAL,	LEAF, OVERFLOW, FREE};
+//where a full node is split: in half, at a fixed ratio, 90/10 at the end where keys are appended,
+//or (leaves) at the edge of the key range of the sorted run being inserted
+enum split_t{ SPLIT_HALF, SPLIT_RATIO, SPLIT_APPEND, SPLIT_RANGE};
+
+//-----------memory pool enums
+//policy used to choose which node is evicted from the memory pool
+enum replacement_t{ REPLACE_CLOCK, REPLACE_LRU2, REPLACE_LASTPATH};
+//where B-tree nodes live in memory: own memory pool or memory-mapped B-tree file
+enum backend_t{ BACKEND_BUFFERED, BACKEND_MMAP};
 
 //-----------------------
 
@@ -48,6 +57,8 @@ int prepareCodeTable();
 int extractWords(char *inputbuffer, int totalChars, unsigned int *hashedwords, int *totalwords);
 int sortHashedWords(unsigned int *hashedwords,int totalwords, unsigned int *tempArray);
 int removeDuplicates(unsigned int *hashedwords,int totalwords,int *distinctWords);
+int readDocumentWords(char *fileName, char *inputbuffer, unsigned int *hashedwords,
+					  unsigned int *tempArray, int *distinctWords);
 int prepareStopWordsSortedList();
 int removeDuplicatesAndStopWords(unsigned int *hashedwords,int totalwords, int *distinctWords);
 
@@ -55,14 +66,38 @@ int testParsing(char *inputbuffer,int totalChars,unsigned int *hashedwords, int
 //-------------------------
 
 //--------btree structures
-#define MAX_DATA_PER_NODE  5100 //for page of 4096 bytes: header size=16 bytes, each data entry is 8 bytes
-#define MAX_TREE_HEIGHT 10
+/*
+Size of a B-tree node on disk and in memory, fixed when the program is compiled,
+so that every node layout below is specialised for it.
+The Makefile builds onlineupdate with the default size and onlineupdate_<N>k for pages of 4 KB to 256 KB.
+The page size is stored in the size file of the index, and an index is only opened with the same page size
+*/
+#ifndef BTREE_PAGE_SIZE
+#define BTREE_PAGE_SIZE 40960
+#endif
+#if BTREE_PAGE_SIZE<4096 || BTREE_PAGE_SIZE>262144 || BTREE_PAGE_SIZE%4096!=0
+#error "BTREE_PAGE_SIZE must be a multiple of 4096 from 4096 to 262144"
+#endif
+#define LEGACY_PAGE_SIZE 40816 //pages of files written before the page size was stored
+#define MAX_DATA_PER_NODE ((BTREE_PAGE_SIZE-16)/8) //header size=16 bytes, each data entry is 8 bytes
+#define MAX_TREE_HEIGHT 10 //enough for any page size: even 4 KB nodes have fanout 510
+
+#define BTREE_FORMAT_VERSION 3 //1 - leaves without sibling links, 2 - no free list in the size file
+
+typedef struct
+{
+	unsigned int nodesCount;
+	unsigned int pageSize;
+	unsigned int formatVersion;
+	unsigned int freeListHead; //first FREE node, 0 - no free nodes
+	unsigned int freeNodesCount;
+}BTreeFileHeader_t; //content of the size file
 #define MAX_UNSIGNED_INT 4294967295
 
 typedef struct
 {
 	short keysCount;  //2
-	short dataFreePosArrID;  //2
+	short dataFreePosArrID;  //2 leaves: next free block in postings, filled backwards
 	unsigned int nodeID;  //4
 	enum node_t nodeType; //4
 	unsigned int maxKey;  // 4 
@@ -73,15 +108,21 @@ typedef struct
 	BTREE WITH BUFFER
 **************************************
 
-This is the main data structure for BTree nodes
-value can be the key, pointer points to a position in data array where the first
-document ID is stored (They filled from the end of the array)
-Afterwards, each element in the array contains document ID where the key occurs,
-in the value field, and in the pointer field it contains 
-the position of the next document where the same key occurs. 0 means no more documents
--1 means that the keys exist in the next sibling node 
-- there may be a lot of documents for the same key
-this is needed mostly for search - not implemented for now
+Internal nodes (and the root) keep sorted entries in the data array:
+value is the largest key of the child subtree, pointer is the nodeID of the child.
+
+Leaves use the same page as a structure of arrays (LeafPage_t):
+prevLeaf, nextLeaf - neighbour leaves in key order, so the leaves can be scanned left to right
+without going up and down the tree (0 - no neighbour, node 0 is always the root);
+keys - sorted keys, contiguous, so the key search reads only keys (4 bytes per key instead of 8)
+and can compare several keys with one vector instruction;
+postingHeaders - parallel to keys: the first and the last block of the posting list of the key,
+the number of its documents and its last document ID, so a document is appended 
+and documents are counted without walking the list;
+postings - heap of posting blocks, filled from the end of the array.
+A posting list is a chain of blocks with document IDs of the key, 
+compressed as varint differences (see postings.c). 
+Block 0 is never used - it marks the end of a chain
 */
 typedef struct
 {
@@ -89,60 +130,247 @@ typedef struct
 	int pointer;  //4	
 }Data_t;
 
+#define POSTING_BLOCK_BYTES 6
+#define POSTING_VARINT_MAX_BYTES 5 //a varint never needs more than one new block
+
+typedef struct
+{
+	short next; //position of the next block of the same key, 0 - the last block
+	unsigned char bytes[POSTING_BLOCK_BYTES]; //varints, a varint may continue in the next block
+}PostingBlock_t;
+
+#define POSTINGS_IN_OVERFLOW -1 //lastBlockBytes of a key whose documents moved to overflow pages
+
+typedef struct
+{
+	union
+	{
+		struct
+		{
+			short firstBlock; //position in postings of the first block of the key
+			short lastBlock; //the next document is appended to this block
+		};
+		unsigned int overflowPage; //first overflow page of the key, if lastBlockBytes==POSTINGS_IN_OVERFLOW
+	};
+	short lastBlockBytes; //bytes used in the last block, all other blocks are full
+	int docsCount;
+	unsigned int lastDocID; //the next document is encoded as a difference from it
+}PostingHeader_t;
+
+#define LEAF_MAX_KEYS (MAX_DATA_PER_NODE/5) //capacity of the leaf key directory, about half of the page
+//the rest of the page holds posting blocks
+#define LEAF_MAX_POSTING_BLOCKS ((MAX_DATA_PER_NODE*sizeof(Data_t)-2*sizeof(unsigned int) \
+	-LEAF_MAX_KEYS*(sizeof(unsigned int)+sizeof(PostingHeader_t)))/sizeof(PostingBlock_t))
+
+typedef struct
+{
+	unsigned int prevLeaf;
+	unsigned int nextLeaf;
+	unsigned int keys[LEAF_MAX_KEYS];
+	PostingHeader_t postingHeaders[LEAF_MAX_KEYS];
+	PostingBlock_t postings[LEAF_MAX_POSTING_BLOCKS];
+}LeafPage_t;
+
+/*
+Overflow pages hold the documents of keys with very long posting lists (heavy hitters).
+Once a key has OVERFLOW_THRESHOLD_DOCS documents, its varints are moved from the leaf blocks
+to a chain of overflow pages, and new documents are appended to the last page of the chain.
+The leaf keeps the posting header of the key (count, last document),
+so the key takes no leaf space anymore and frequent keys stop splitting leaves
+*/
+//a third of the leaf blocks, so that small pages move heavy keys out before the key fills the leaf
+#define OVERFLOW_THRESHOLD_DOCS MIN(4096,(int)(LEAF_MAX_POSTING_BLOCKS*POSTING_BLOCK_BYTES/3))
+#define OVERFLOW_PAGE_BYTES (MAX_DATA_PER_NODE*sizeof(Data_t)-3*sizeof(unsigned int))
+
+typedef struct
+{
+	unsigned int nextPage; //0 - the last page of the chain
+	unsigned int lastPage; //first page of the chain only: where the next document is appended
+	unsigned int usedBytes;
+	unsigned char bytes[OVERFLOW_PAGE_BYTES]; //varints continue from the previous page
+}OverflowPage_t;
+
+/*
+Nodes released by compaction are FREE: they stay in the B-tree file as a chain which starts in the size file,
+and createNewNode takes them from the chain before it extends the file
+*/
+typedef struct
+{
+	unsigned int nextFree; //0 - the last free node
+}FreePage_t;
+
 typedef struct
 {
 	NodeHeader_t header;  //2
-	Data_t data[MAX_DATA_PER_NODE];
+	union
+	{
+		Data_t data[MAX_DATA_PER_NODE]; //ROOT and INTERNAL nodes
+		LeafPage_t leaf; //LEAF nodes, the same size as data
+		OverflowPage_t overflow; //OVERFLOW nodes
+		FreePage_t free; //FREE nodes
+	};
 }BTreeNode_t;
 
+//compilation fails here if a node layout does not fit the page
+typedef char BTreeNodeSizeCheck_t[(sizeof(BTreeNode_t)==BTREE_PAGE_SIZE 
+	&& sizeof(LeafPage_t)<=sizeof(Data_t)*MAX_DATA_PER_NODE) ? 1 : -1];
+
 
 
 
 
 
 //----------memorypool structures
-#define MAX_NODES_INMEM 10000
+#ifndef MEMORY_POOL_BYTES
+#define MEMORY_POOL_BYTES (400*1024*1024)
+#endif
+#define MAX_NODES_INMEM (MEMORY_POOL_BYTES/BTREE_PAGE_SIZE)
+//internal nodes are kept in a separate area of the memory pool, after the MAX_NODES_INMEM frames,
+//and are never evicted, so a descent reads at most one node - the leaf
+#ifndef PINNED_POOL_BYTES
+#define PINNED_POOL_BYTES (64*1024*1024)
+#endif
+#define MAX_PINNED_NODES (PINNED_POOL_BYTES/BTREE_PAGE_SIZE)
 
 typedef struct
 {
 	unsigned int nodeID;	
 	enum BOOL isOccupied;	
+	enum BOOL isDirty; //node was modified since it was last written to disk
+	enum BOOL isPinned; //node cannot be evicted - its read is in progress, or the caller still uses it
+	enum BOOL isReferenced; //CLOCK reference bit
+	unsigned int lastAccess; //LRU-2: time of the last access
+	unsigned int prevAccess; //LRU-2: time of the access before the last one, 0 - accessed only once
 }InMemNodeInfo_t;
 
 typedef struct
 {		
 	int currentFreePosition;	
-	BTreeNode_t *nodes;
+	int pinnedNodesCount; //occupied frames of the pinned area
+	BTreeNode_t *nodes; //MAX_NODES_INMEM frames for any node, then MAX_PINNED_NODES frames for internal nodes
 }MemoryPool_t;
 
+//page table: open-addressing map nodeID -> position in memory pool
+//power of 2, at least twice MAX_NODES_INMEM+MAX_PINNED_NODES, so that it is never full
+//and probe sequences stay short. It follows the pool sizes which are set at build time
+#define PAGE_TABLE_MIN_SIZE (2*(MAX_NODES_INMEM+MAX_PINNED_NODES))
+//x|x>>1|x>>2|... sets all bits below the highest one, +1 then gives the next power of 2
+#define SMEAR_BITS_1(x) ((x)|((x)>>1))
+#define SMEAR_BITS_2(x) (SMEAR_BITS_1(x)|(SMEAR_BITS_1(x)>>2))
+#define SMEAR_BITS_4(x) (SMEAR_BITS_2(x)|(SMEAR_BITS_2(x)>>4))
+#define SMEAR_BITS_8(x) (SMEAR_BITS_4(x)|(SMEAR_BITS_4(x)>>8))
+#define SMEAR_BITS_16(x) (SMEAR_BITS_8(x)|(SMEAR_BITS_8(x)>>16))
+#define PAGE_TABLE_SIZE (SMEAR_BITS_16(PAGE_TABLE_MIN_SIZE-1)+1)
+#define PAGE_TABLE_EMPTY -1
+
+//memory-mapped backend
+#define MMAP_MAX_NODES ((int)((40LL*1024*1024*1024)/BTREE_PAGE_SIZE)) //address space reserved for the mapping, 40 GB
+#define MMAP_GROW_BYTES (64*1024*1024) //file is extended and mapped by this amount, multiple of page size
+
+//asynchronous node reader asyncread.c
+#define ASYNC_READ_QUEUE_DEPTH 64 //max number of node reads in one batch
+#define PREFETCH_MAX_NODES MIN(512,MAX_NODES_INMEM/4) //max nodes per tree level read ahead for one bucket transfer
+#define PREFETCH_CHILDREN_NODES MIN(ASYNC_READ_QUEUE_DEPTH,MAX_NODES_INMEM/4) //max children of one node read in one batch
+
+typedef struct
+{
+	int ringfd; //io_uring descriptor, -1 if io_uring is not available and reads are synchronous
+	void *sqRing;
+	void *cqRing;
+	void *sqes; //array of submission queue entries
+	void *cqes; //array of completion queue entries
+	size_t sqRingSize;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned int *sqTail;
+	unsigned int *sqMask;
+	unsigned int *sqArray;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int *cqMask;
+}AsyncReader_t;
+
+typedef struct
+{
+	unsigned int nodeID;
+	int memPoolPos; //PAGE_TABLE_EMPTY if the entry is not used
+}PageTableEntry_t;
+
 typedef struct
 {	
 	unsigned int maxNodesOnDisk;
 	BTreeNode_t * lastPath[MAX_TREE_HEIGHT];
 	short lastPathCurrentPointers [MAX_TREE_HEIGHT];  //show position in the node afer current insertion 
 	short curTreeLevel;
-	FILE *btreefile;
+	int btreefd; //B-tree file is accessed by page with pread/pwrite, no stdio buffering
 	FILE *sizefile;
 	InMemNodeInfo_t *memPoolPointers;
 	MemoryPool_t *memPool;	
+	PageTableEntry_t *pageTable;
+	enum replacement_t replacementPolicy;
+	unsigned int accessCounter; //logical time for LRU-2
+	enum backend_t backend;
+	BTreeNode_t *mappedNodes; //BACKEND_MMAP: start of the mapped B-tree file
+	size_t mappedBytes; //BACKEND_MMAP: how much of the file is currently mapped
+	size_t mappedPageSize; //BACKEND_MMAP: system page size, read once when the file is mapped
+	AsyncReader_t asyncReader;
+	enum split_t splitPolicy;
+	int splitRatio; //SPLIT_RATIO: percent of keys which stay in the left node
+	unsigned int runMaxKey; //the largest key of the sorted run being inserted, for SPLIT_RANGE
+	unsigned int freeListHead; //first FREE node to be reused by createNewNode, 0 - none
+	unsigned int freeNodesCount;
 }SystemState_t;
 
+#define SPLIT_APPEND_PERCENT 90 //SPLIT_APPEND: keys left in the node which does not receive appended keys
+
 
 int initMemoryPool(SystemState_t *state);
 BTreeNode_t* createNewNode (SystemState_t *state, enum node_t node_type );
+BTreeNode_t* reuseFreeNode(SystemState_t *state, enum node_t node_type);
+void freeNode(SystemState_t *state, BTreeNode_t *node);
 int flashNodeToDisk (SystemState_t *state, int arrPointersPos, enum BOOL setFree, enum BOOL isNew);
 int getFreeSpotInBuffer(SystemState_t *state, int currFreePos);
+int getFreeSpotClock(SystemState_t *state, int currFreePos);
+int getFreeSpotLRU2(SystemState_t *state);
+int getFreeSpotLastPath(SystemState_t *state, int currFreePos);
+void markNodeUsed(SystemState_t *state, int memPoolPos);
+void markNodeDirty(SystemState_t *state, BTreeNode_t *node);
+void holdNodeInMemory(SystemState_t *state, BTreeNode_t *node, enum BOOL hold);
 enum BOOL isRecentlyUsed(SystemState_t *state, unsigned int nodeID);
+enum BOOL canEvict(SystemState_t *state, int memPoolPos);
 BTreeNode_t* getNode(SystemState_t *state, unsigned int nodeID);
 BTreeNode_t* loadNodeFromDisk (SystemState_t *state, unsigned int nodeID);
+BTreeNode_t* pinInternalNode(SystemState_t *state, BTreeNode_t *node);
+void reportPinnedLevels(SystemState_t *state);
+int prefetchNodes(SystemState_t *state, unsigned int *nodeIDs, int nodesCount);
 int finish_SynchronizeData(SystemState_t *state);
+int findInPageTable(SystemState_t *state, unsigned int nodeID);
+int addToPageTable(SystemState_t *state, unsigned int nodeID, int memPoolPos);
+int removeFromPageTable(SystemState_t *state, unsigned int nodeID);
+
+//----------Memory-mapped B-tree file mmapbtree.c
+int initMappedBTree(SystemState_t *state);
+BTreeNode_t* getMappedNode(SystemState_t *state, unsigned int nodeID);
+void adviseMappedNodes(SystemState_t *state, unsigned int *nodeIDs, int nodesCount);
+BTreeNode_t* createNewMappedNode(SystemState_t *state, enum node_t node_type);
+int syncMappedBTree(SystemState_t *state);
+
+//----------Asynchronous node reads asyncread.c
+int initAsyncReader(AsyncReader_t *reader);
+void closeAsyncReader(AsyncReader_t *reader);
+int readNodesAsync(AsyncReader_t *reader, int btreefd, 
+				   unsigned int *nodeIDs, BTreeNode_t **targets, int nodesCount);
 
 //----------Disk read-write diskaccess.c
 unsigned int getBTreeSize(SystemState_t *state);
-int moveInBTreeFile(FILE* btreefile, unsigned int nodeID);
+int writeBTreeSize(FILE *sizefile, unsigned int nodesCount, unsigned int freeListHead, unsigned int freeNodesCount);
+off_t getNodeOffset(unsigned int nodeID);
+int readNodesFromFile(int btreefd, unsigned int firstNodeID, unsigned int nodesCount, BTreeNode_t *nodes);
+int writeNodeToFile(int btreefd, BTreeNode_t *node);
 
 //------------btree functions
-int insertSortedKeyFromBuffer(SystemState_t *state, unsigned int  key, int documentID);
+int insertSortedBatchFromBuffer(SystemState_t *state, Data_t *keys, int keysCount);
+int mergeSortedRunIntoLeaf(SystemState_t *state, BTreeNode_t *leaf, Data_t *keys, int keysCount);
 int findLeafToInsert(SystemState_t *state, unsigned int keyTobeInserted);
 int searchUp(SystemState_t *state, unsigned int key);
 int searchDown(SystemState_t *state, unsigned int key);
@@ -158,12 +386,73 @@ int updateNodeParentAfterSplit(SystemState_t *state,
 int resetBTreePath(SystemState_t *state);
 int checkCircularReference(BTreeNode_t *currentLeaf);
 int invalidLeaf(BTreeNode_t *currLeaf);
+int prefetchChildrenInRange(SystemState_t *state, BTreeNode_t *node, int fromPos, unsigned int maxKey);
+int prefetchKeyRange(SystemState_t *state, unsigned int minKey, unsigned int maxKey);
+
+//------------merging of under-filled nodes compaction.c
+#define COMPACT_FILL_PERCENT 70 //two neighbours are merged if together they fill at most this part of a node
+
+typedef struct
+{
+	int leavesMerged;
+	int internalMerged;
+	int levelsRemoved;
+}CompactionStats_t;
 
+int compactBTree(SystemState_t *state, CompactionStats_t *stats);
+
+
+//-------------compressed posting lists postings.c
+typedef struct
+{
+	unsigned int docID; //last decoded document
+	unsigned int value; //varint which continues in the next bytes
+	int shift;
+}PostingDecoder_t;
+
+int encodePosting(PostingHeader_t *postingHeader, unsigned int docID, unsigned char *code);
+int decodePostingBytes(PostingDecoder_t *decoder, unsigned char *bytes, int bytesCount, unsigned int *docIDs);
+int appendPosting(BTreeNode_t *leaf, PostingHeader_t *postingHeader, unsigned int docID);
+int decodePostings(LeafPage_t *page, PostingHeader_t *postingHeader, unsigned int *docIDs);
+int countPostingBlocks(LeafPage_t *page, PostingHeader_t *postingHeader);
+int copyPostingList(BTreeNode_t *leaf, LeafPage_t *fromPage, 
+					PostingHeader_t *fromHeader, PostingHeader_t *toHeader);
+int compactPostings(BTreeNode_t *leaf);
+
+//-------------overflow posting pages overflow.c
+int addDocumentToKey(SystemState_t *state, BTreeNode_t *leaf, 
+					 PostingHeader_t *postingHeader, unsigned int docID);
+int moveHeavyKeysToOverflow(SystemState_t *state, BTreeNode_t *leaf);
+int decodeKeyPostings(SystemState_t *state, LeafPage_t *page, 
+					  PostingHeader_t *postingHeader, unsigned int *docIDs);
+
+//-------------key search inside a node nodesearch.c
+int findFirstNotLess(Data_t *data, int from, int to, unsigned int key);
+int findFirstNotLessLinear(Data_t *data, int from, int to, unsigned int key);
+int findFirstNotLessKey(unsigned int *keys, int from, int to, unsigned int key);
 
 //-------------key search
 int findWordHashInBTree(SystemState_t *state, unsigned int key,  int *totalDocs);
-int searchKeyDown(SystemState_t *state, unsigned int key);
-int searchKeyUp(SystemState_t *state, unsigned int key);
+
+//-------------ordered scan of leaves cursor.c
+#define CURSOR_READAHEAD_LEAVES MAX(1,PREFETCH_MAX_NODES/2) //leaves scanned before the next read-ahead
+
+typedef struct
+{
+	SystemState_t *state;
+	unsigned int toKey; //the scan ends after this key
+	unsigned int leafID; //leaf with the next key, 0 - the scan is over
+	int pos; //position of the next key in this leaf
+	int leavesToReadAhead;
+	//the current key, set by nextCursor
+	unsigned int key;
+	unsigned int keyLeafID;
+	PostingHeader_t postingHeader;
+}BTreeCursor_t;
+
+int seekCursor(SystemState_t *state, BTreeCursor_t *cursor, unsigned int fromKey, unsigned int toKey);
+int nextCursor(BTreeCursor_t *cursor);
+int readCursorPostings(BTreeCursor_t *cursor, unsigned int *docIDs);
 
 //---------bitoperations
 #define NUM_BITS_INUINT 32
@@ -177,20 +466,32 @@ int getLCPwithBitsAfterLCP(unsigned int *first, unsigned int *second,char *bit1,
 
 //----------dynamic buckets
 //-----buckets structures
-#define MAX_KEYS_PER_BUCKET 1280//about 1/10 of keys per BTree node
-#define MAX_NUMBER_OF_BUCKETS 400//100 tbc
-#define MAX_TOP_TREE_NODES 800 // always twice MAX_NUMBER_OF_BUCKETS
+/*
+The number of buckets and their capacity are set when the buffer is created:
+by default DEFAULT_NUMBER_OF_BUCKETS buckets of DEFAULT_KEYS_PER_BUCKET keys,
+or as many buckets as fit into a memory budget. The top tree has twice as many nodes as buckets
+*/
+#define DEFAULT_KEYS_PER_BUCKET 1280//about 1/10 of keys per BTree node
+#define DEFAULT_NUMBER_OF_BUCKETS 400
+#define MIN_NUMBER_OF_BUCKETS 3 //the root with 2 buckets, and 1 more to split
+#define MAX_NUMBER_OF_BUCKETS 1000000000 //IDs of top tree nodes, twice the buckets, are int
 
+/*
+Keys are appended to a bucket in arrival order and sorted only when the bucket is split or transferred.
+sortedCount - the number of keys at the start of data which are already in key order,
+so a bucket which received its keys in order is not sorted again
+*/
 typedef struct
 {
 	int keysCount;
 	int LCPinBits;
+	int sortedCount;
 }BucketHeader_t;
 
 typedef struct
 {
 	BucketHeader_t header;
-	Data_t data[MAX_KEYS_PER_BUCKET];
+	Data_t *data; //keysPerBucket keys in the common array of the buffer
 }Bucket_t;
 
 typedef struct
@@ -199,42 +500,67 @@ typedef struct
 	int freeNodePos;  //when removing 1 bucket we can free 1 node
 	int bucketsCounter;
 	int freeBucketID;	
+	int maxBucketsCount; //bucket IDs are from 1 to maxBucketsCount-1
+	int keysPerBucket;
+	int maxNodesCount; //twice maxBucketsCount
 }TopTreeHeader_t;
 
 typedef struct
 {
-	short children[2];
+	int children[2];
 	short incomingEdgeLength;
 }TopTreeNode_t;
 
 typedef struct
 {
 	TopTreeNode_t *node;
-	int nodeID; //TBC remove ???
+	int nodeID;
 	char whatChild; //0-for left, 1 for right
 }TopTreeNodePointer_t;
 
 typedef struct
 {
 	TopTreeHeader_t header;
-	TopTreeNode_t nodes[MAX_TOP_TREE_NODES];
+	TopTreeNode_t *nodes; //maxNodesCount nodes
 }TopTree_t;
 
+/*
+Eviction candidates: top tree nodes whose both children are buckets - one of them can be transferred
+and the node replaced by the other bucket. They are kept in a max-heap ordered by the depth of the node
+(the number of leading bits shared by all keys of both buckets), then by the number of keys in both buckets,
+and the heap is updated by every change of the tree and of the bucket sizes
+*/
+typedef struct
+{
+	int *heap; //top tree node IDs
+	int count;
+	int *heapPos; //position of the node in heap, -1 - not a candidate
+	short *depth; //distance of the node from the root in bits
+	int *nodeParent;
+	int *bucketParent; //top tree node which has the bucket as a child
+}EvictionHeap_t;
+
 typedef struct
 {
 	TopTree_t tree;
 	Bucket_t *buckets;
-	TopTreeNodePointer_t parentOfDeepestBucket;
+	Data_t *keys; //data of all buckets
+	Data_t *sortScratch; //keysPerBucket keys for sorting a bucket
+	EvictionHeap_t candidates;
 	TopTreeNodePointer_t lastPath[NUM_BITS_INUINT];
 	int currentTreeLevel;
+	unsigned int lastKey; //lastPath is the path to the bucket of this key, if lastPathValid
+	enum BOOL lastPathValid; //the tree did not change since lastPath was found
 }Buffer_t;
 
 
-int initBuffer(Buffer_t *buffer);
+int initBuffer(Buffer_t *buffer, size_t memoryBytes, int keysPerBucket);
+int serializeBuffer(Buffer_t *buffer, FILE *file);
 int synchronizeBuffer(Buffer_t *buffer,SystemState_t *state );
 
 int insertKeyIntoBuffer(unsigned int key, unsigned int docID, Buffer_t *buffer, SystemState_t *state);
 int moveUpInTree(int *distanceFromRoot, Buffer_t *buffer, int lcp);
+int searchUpInTree(Buffer_t *buffer, int lcp);
 int findBucketForKey(unsigned int key, Buffer_t *buffer, SystemState_t *state);
 int blindSearch(int *distanceFromRoot, Buffer_t* buffer, unsigned int key, SystemState_t *state);
 
@@ -243,7 +569,10 @@ int getFreeNodeID(Buffer_t *buffer);
 
 
 int transferOneBucketToBTree(Buffer_t *buffer,SystemState_t *state) ;
-void traverseForDeepestInternalNode(Buffer_t *buffer, int distanceFromRoot, int maxLCP, TopTreeNode_t *currParent);
+int writeBucketToBTree(SystemState_t *state, Buffer_t *buffer, Bucket_t *bucket);
+void sortBucket(Buffer_t *buffer, Bucket_t *bucket);
+void sortBufferBuckets(Buffer_t *buffer);
+void updateEvictionCandidate(Buffer_t *buffer, int nodeID);
 
 int addKeyToBucket(Buffer_t *buffer, int bucketID, unsigned int key, unsigned int docID);
 int splitBucket(SystemState_t *state,Buffer_t *buffer,int bucketID, int parentDistanceFromRoot);
@@ -1,4 +1,7 @@
 #include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /**
 This is a program which will take a bunch of text files from the specified folder,
@@ -21,9 +24,8 @@ int totalKeysInserted=0;
 
 int main(int argc, char *argv[]) {
 	int i,j;
-	FILE *inputfile;
 	FILE *sizefile;
-	FILE *btreefile;
+	int btreefd;
 	char inputFilePrefix[MAX_PATH_LENGTH];
 	int minsubsript;
 	int maxsubscript;
@@ -33,9 +35,6 @@ int main(int argc, char *argv[]) {
 	unsigned int *hashedwords;
 	unsigned int *temparray;  //for sorting
 	int docID;
-	int totalChars;
-	int res;
-	int totalwords;
 	int distinctWords;
 	char btreeFileName[MAX_PATH_LENGTH];
 	char sizeFileName[MAX_PATH_LENGTH];
@@ -44,14 +43,16 @@ int main(int argc, char *argv[]) {
 	int filedelta;
 	FILE *bufferfile;
 	char bufferfilename[MAX_PATH_LENGTH];
-	TopTree_t *tree;
-
-	unsigned int btreesizebuf[1];
+	enum BOOL compact=FALSE;
+	size_t bufferBytes=0; //0 - default number of buckets
+	int keysPerBucket=DEFAULT_KEYS_PER_BUCKET;
+	CompactionStats_t compactionStats;
 
 	
 	if(argc<9)	{
 		printf("To run: ./onlineupdate <inputfolder> <inputfileprefix>  <minSubscript> <maxSubscript>" 
-			"<fileextension> <outputfolder> <btreefilename> <filedelta>\n");
+			"<fileextension> <outputfolder> <btreefilename> <filedelta> [clock|lru2|lastpath] [buffered|mmap]"
+			" [half|append|range|<left percent>] [compact|nocompact] [<buffer MB>] [<keys per bucket>]\n");
 		
 		return RESULT_ERROR;
 	}
@@ -70,19 +71,74 @@ int main(int argc, char *argv[]) {
 	sprintf(bufferfilename,"%s_buffer", btreeFileName);
 	filedelta=atoi(argv[8]);
 
+	state.replacementPolicy=REPLACE_CLOCK;
+	state.accessCounter=0;
+	if(argc>9)	{
+		if(strcmp(argv[9],"lru2")==0)
+			state.replacementPolicy=REPLACE_LRU2;
+		else if(strcmp(argv[9],"lastpath")==0)
+			state.replacementPolicy=REPLACE_LASTPATH;
+		else if(strcmp(argv[9],"clock")!=0)	{
+			printf("Unknown replacement policy %s, expected clock, lru2 or lastpath\n",argv[9]);
+			return RESULT_ERROR;
+		}
+	}
+
+	state.backend=BACKEND_BUFFERED;
+	if(argc>10)	{
+		if(strcmp(argv[10],"mmap")==0)
+			state.backend=BACKEND_MMAP;
+		else if(strcmp(argv[10],"buffered")!=0)	{
+			printf("Unknown memory pool backend %s, expected buffered or mmap\n",argv[10]);
+			return RESULT_ERROR;
+		}
+	}
+
+	state.splitPolicy=SPLIT_HALF;
+	state.splitRatio=50;
+	if(argc>11)	{
+		if(strcmp(argv[11],"append")==0)
+			state.splitPolicy=SPLIT_APPEND;
+		else if(strcmp(argv[11],"range")==0)
+			state.splitPolicy=SPLIT_RANGE;
+		else if(atoi(argv[11])>=10 && atoi(argv[11])<=90)	{
+			state.splitPolicy=SPLIT_RATIO;
+			state.splitRatio=atoi(argv[11]);
+		}
+		else if(strcmp(argv[11],"half")!=0)	{
+			printf("Unknown split policy %s, expected half, append, range or percent of keys in the left node (10-90)\n",argv[11]);
+			return RESULT_ERROR;
+		}
+	}
+
+	if(argc>12)	{
+		if(strcmp(argv[12],"compact")==0)
+			compact=TRUE;
+		else if(strcmp(argv[12],"nocompact")!=0)	{
+			printf("Unknown compaction option %s, expected compact or nocompact\n",argv[12]);
+			return RESULT_ERROR;
+		}
+	}
+
+	if(argc>13)	{
+		if(atoi(argv[13])<0)	{
+			printf("Invalid buffer size %s MB\n",argv[13]);
+			return RESULT_ERROR;
+		}
+		bufferBytes=((size_t)atoi(argv[13]))<<20;
+	}
+
+	if(argc>14)
+		keysPerBucket=atoi(argv[14]);
+
 //B. initialize Btree, memory pool and state
 //B1. Set pointer to BTree file, create the file if does not exist
-	if(!(btreefile= fopen ( btreeFileName , "r+b" )))	{
+	if((btreefd= open ( btreeFileName , O_RDWR ))<0)	{
 		printf("creating a new btree file\n");
-		if(!(btreefile= fopen ( btreeFileName , "wb" )))	{
+		if((btreefd= open ( btreeFileName , O_RDWR | O_CREAT, 0644 ))<0)	{
 			printf("Could not create new BTree file %s \n",btreeFileName);
 			return RESULT_ERROR;
 		}
-		fclose(btreefile);
-		if(!(btreefile= fopen ( btreeFileName , "r+b" )))	{
-			printf("Could not open BTree file %s \n",btreeFileName);
-			return RESULT_ERROR;
-		}
 	}
 
 //B2. Determine size of the BTree file if exists - to know how many nodes are already on disk
@@ -100,13 +156,13 @@ int main(int argc, char *argv[]) {
 	}	
 
 //B3. Init memory pool and load some nodes in memory
-	state.btreefile=btreefile;
+	state.btreefd=btreefd;
 	state.sizefile=sizefile;
 	if(initMemoryPool(&state))
 		return RESULT_ERROR;
 
 	//4. init memory pool
-	if(initBuffer(&buffer))
+	if(initBuffer(&buffer, bufferBytes, keysPerBucket))
 		return RESULT_ERROR;
 
 	//reading input, hashing, parsing and insertion into buffer
@@ -140,31 +196,9 @@ int main(int argc, char *argv[]) {
 		docID=i-filedelta;
 		sprintf(currInputFileName,"%s%d%s", inputFilePrefix, i,fileextension);
 		
-		if(!(inputfile= fopen ( currInputFileName , "rb" )))	{
-			printf("Could not open input file %s \n",currInputFileName);
-			return RESULT_ERROR;
-		}
-
-		//read content of a file into a buffer
-		res=fread (inputbuffer,sizeof(char),INPUT_BUFFER_MAX,inputfile);
-		if(res<INPUT_BUFFER_MAX && res>0)
-			totalChars=res;
-		else if (res==0)	{
-			printf("Error reading File %s . Empty file?\n",currInputFileName);
+		//parse into sorted distinct words
+		if(readDocumentWords(currInputFileName,inputbuffer,hashedwords,temparray,&distinctWords))
 			return RESULT_ERROR;
-		}
-		else	{
-			printf("File %s is too large (%d) for the input buffer of size %d\n",currInputFileName,res,INPUT_BUFFER_MAX);
-			return RESULT_ERROR;
-		}
-
-		totalwords=0;
-		extractWords(inputbuffer,totalChars,hashedwords,&totalwords);
-
-		sortHashedWords(hashedwords,totalwords,temparray);
-	
-		distinctWords=0;
-		removeDuplicates(hashedwords,totalwords,&distinctWords);
 		totalKeysInserted+=distinctWords;
 		
 		for(j=0;j<distinctWords;j++) {				
@@ -175,10 +209,21 @@ int main(int argc, char *argv[]) {
 		}		
 	
 		resetBTreePath(&state);
-		fclose(inputfile);
 
 		printf ("Inserted all keywords from file %s\n",  currInputFileName);
 	}
+
+	if(compact==TRUE)	{
+		if(compactBTree(&state, &compactionStats))	{
+			printf("Failed to compact BTree\n");
+			return RESULT_ERROR;
+		}
+		printf("Compaction merged %d leaves and %d internal nodes, removed %d levels, %u nodes are free\n",
+			compactionStats.leavesMerged,compactionStats.internalMerged,compactionStats.levelsRemoved,
+			state.freeNodesCount);
+	}
+
+	reportPinnedLevels(&state);
 	printf("Serializing buffer\n");
 
 	if(!(bufferfile= fopen ( bufferfilename , "wb" )))	{
@@ -186,28 +231,19 @@ int main(int argc, char *argv[]) {
 		return RESULT_ERROR;
 	}
 
-	tree=&(buffer.tree);
-	if(fwrite(tree,sizeof(TopTree_t),1, bufferfile)!=1)	{
-		printf("failed to serialize buffer top tree\n");
+	if(serializeBuffer(&buffer, bufferfile))
 		return RESULT_ERROR;
-	}
-	
-	if(fwrite(buffer.buckets,sizeof(Bucket_t),MAX_NUMBER_OF_BUCKETS, bufferfile)!=MAX_NUMBER_OF_BUCKETS) {
-		printf("failed to serialize buffer buckets\n");
-		return RESULT_ERROR;
-	}
+	fclose(bufferfile);
 
 	finish_SynchronizeData(&state);
+	close(btreefd);
 	fclose(sizefile);
 	if(!(sizefile= fopen ( sizeFileName , "wb" )))	{
 		printf("Could not open size file %s for writing new BTree size\n",sizeFileName);
 		return RESULT_ERROR;
 	}
-	btreesizebuf[0]=state.maxNodesOnDisk;
-	if(fwrite(btreesizebuf,sizeof(unsigned int),1,sizefile)!=1)	{
-		printf("Failed to save new BTree file size\n");
+	if(writeBTreeSize(sizefile,state.maxNodesOnDisk,state.freeListHead,state.freeNodesCount))
 		return RESULT_ERROR;
-	}
 	fclose(sizefile);
 	
 	return RESULT_OK;
@@ -1,4 +1,75 @@
 #include "general.h"
+#include <string.h>
+
+/*
+reads the internal levels of an existing tree into the pinned area, top-down and level by level,
+until all of them are in memory or the area is full.
+The height of the tree is found by descending along the leftmost path
+*/
+static int loadInternalLevels(SystemState_t *state)
+{
+	unsigned int *queue;
+	BTreeNode_t *node=state->lastPath[0];
+	int height=0,level;
+	int queued=0,levelStart=0,levelEnd;
+	int i,j;
+
+	//empty tree, or the program is built without the pinned area
+	if(node->header.keysCount==0 || MAX_PINNED_NODES==0)
+		return 0;
+	while(node->header.nodeType!=LEAF)
+	{
+		node=getNode(state,node->data[0].pointer);
+		if(node==NULL)
+		{
+			printf("Leftmost node of level %d not found\n",height+1);
+			return 1;
+		}
+		height++;
+	}
+
+	queue=(unsigned int *) calloc (MAX_PINNED_NODES, sizeof(unsigned int));
+	if(queue==NULL)
+	{
+		printf("Failed to allocate memory for the queue of %d internal nodes\n",MAX_PINNED_NODES);
+		return 1;
+	}
+
+	//level 1 are the children of the root, leaves are at level height
+	node=state->lastPath[0];
+	for(j=0;j<node->header.keysCount && queued<MAX_PINNED_NODES;j++)
+		queue[queued++]=node->data[j].pointer;
+
+	for(level=1;level<height;level++)
+	{
+		levelEnd=queued;
+		for(i=levelStart;i<levelEnd;i++)
+		{
+			if((i-levelStart)%ASYNC_READ_QUEUE_DEPTH==0 
+				&& prefetchNodes(state,&queue[i],MIN(ASYNC_READ_QUEUE_DEPTH,levelEnd-i)))
+				break;
+			node=getNode(state,queue[i]);
+			if(node==NULL)
+			{
+				free(queue);
+				return 1;
+			}
+			node=pinInternalNode(state,node);
+			if(node-state->memPool->nodes<MAX_NODES_INMEM) //the pinned area is full
+				break;
+			for(j=0;level+1<height && j<node->header.keysCount && queued<MAX_PINNED_NODES;j++)
+				queue[queued++]=node->data[j].pointer;
+		}
+		if(i<levelEnd)
+			break;
+		levelStart=levelEnd;
+	}
+
+	free(queue);
+	reportPinnedLevels(state);
+	return 0;
+}
+
 
 /*
 This routine initializes the memory pool buffer
@@ -14,11 +85,15 @@ to the lastPath [0]
 int initMemoryPool(SystemState_t *state)
 {
 	unsigned int nodesInFile,i;
-	int res;
 	MemoryPool_t *memPool;
 	InMemNodeInfo_t *memPoolPointers;
+	PageTableEntry_t *pageTable;
 	BTreeNode_t* node;
 
+	//nodes are accessed directly in the mapped file, no memory pool is needed
+	if(state->backend==BACKEND_MMAP)
+		return initMappedBTree(state);
+
 	//1. Allocate memory for memory pool pointer
 	memPool=(MemoryPool_t *) calloc (1, sizeof(MemoryPool_t));
 	if(memPool==NULL)
@@ -29,22 +104,34 @@ int initMemoryPool(SystemState_t *state)
 	}
 
 	// 2. allocate memory for BTree nodes array 
-	memPool->nodes=(BTreeNode_t *) calloc (MAX_NODES_INMEM, sizeof(BTreeNode_t));
+	//   together with the pinned area for internal nodes
+	memPool->nodes=(BTreeNode_t *) calloc (MAX_NODES_INMEM+MAX_PINNED_NODES, sizeof(BTreeNode_t));
 	if(memPool->nodes==NULL)
 	{
 		printf("Failed to allocate memory for BTreeNode_t memory pool of size: %d \n",
-			MAX_NODES_INMEM);
+			MAX_NODES_INMEM+MAX_PINNED_NODES);
 		return 1;
 	}
 	
 	//3. Allocate memory for node pointers array
-	memPoolPointers=(InMemNodeInfo_t *) calloc (MAX_NODES_INMEM, sizeof(InMemNodeInfo_t));
+	memPoolPointers=(InMemNodeInfo_t *) calloc (MAX_NODES_INMEM+MAX_PINNED_NODES, sizeof(InMemNodeInfo_t));
 	if(memPoolPointers==NULL)
 	{
 		printf("Failed to allocate memory for InMemNodeInfo_t memory pool pointers of size: %d \n",
-			MAX_NODES_INMEM);
+			MAX_NODES_INMEM+MAX_PINNED_NODES);
+		return 1;
+	}
+
+	//4. Allocate memory for the page table which maps nodeID to the position in memory pool
+	pageTable=(PageTableEntry_t *) calloc (PAGE_TABLE_SIZE, sizeof(PageTableEntry_t));
+	if(pageTable==NULL)
+	{
+		printf("Failed to allocate memory for PageTableEntry_t page table of size: %d \n",
+			PAGE_TABLE_SIZE);
 		return 1;
 	}
+	for(i=0;i<PAGE_TABLE_SIZE;i++)
+		pageTable[i].memPoolPos=PAGE_TABLE_EMPTY;
 
 	//5. determine the number of nodes on disk
 	nodesInFile=getBTreeSize(state);
@@ -53,8 +140,11 @@ int initMemoryPool(SystemState_t *state)
 	state->memPool=memPool;
 //	memory pool is empty, Current free position is 0
 	state->memPool->currentFreePosition=0;
+	state->memPool->pinnedNodesCount=0;
 	state->memPoolPointers=memPoolPointers;
+	state->pageTable=pageTable;
 	state->maxNodesOnDisk=nodesInFile;
+	initAsyncReader(&state->asyncReader);
 
 	//7. Depending on the number of nodes in btree file
 	//7a. No nodes - create root node
@@ -78,11 +168,9 @@ int initMemoryPool(SystemState_t *state)
 	//7b. If nodes fit, load them all
 	if(nodesInFile<MAX_NODES_INMEM)   
 	{
-		res=fread(&state->memPool->nodes[0],sizeof(BTreeNode_t),nodesInFile,state->btreefile);
-		rewind(state->btreefile);
-		if((unsigned int)res!=nodesInFile)
+		if(readNodesFromFile(state->btreefd,0,nodesInFile,&state->memPool->nodes[0]))
 		{
-			printf("Error reading Btree nodes from file: supposed to read %u and read %d \n",nodesInFile,res);
+			printf("Error reading %u Btree nodes from file\n",nodesInFile);
 			return 1;
 		}
 		
@@ -90,7 +178,8 @@ int initMemoryPool(SystemState_t *state)
 		{
 			memPoolPointers[i].nodeID=state->memPool->nodes[i].header.nodeID;
 			memPoolPointers[i].isOccupied=TRUE;
-			
+			addToPageTable(state,memPoolPointers[i].nodeID,i);
+			markNodeUsed(state,i);
 		}		
 
 		state->curTreeLevel=0;
@@ -99,13 +188,11 @@ int initMemoryPool(SystemState_t *state)
 		
 		printf("There were %d nodes in an existing BTree file\n",nodesInFile);
 		state->lastPathCurrentPointers[0]=0;
-		return 0;
+		return loadInternalLevels(state);
 	}
 
 	//7c. The general situation when file is big so we load only the root node
-	res=fread(&state->memPool->nodes[0],sizeof(BTreeNode_t),1,state->btreefile);
-	rewind(state->btreefile);
-	if(res!=1)
+	if(readNodesFromFile(state->btreefd,0,1,&state->memPool->nodes[0]))
 	{
 		printf("Error reading Btree root from file\n");
 		return 1;
@@ -113,13 +200,15 @@ int initMemoryPool(SystemState_t *state)
 
 	memPoolPointers[0].nodeID=0;
 	memPoolPointers[0].isOccupied=TRUE;
+	addToPageTable(state,0,0);
+	markNodeUsed(state,0);
 
 	state->curTreeLevel=0;
 	state->lastPath[0]=&(state->memPool->nodes[0]);
 	state->memPool->currentFreePosition=1;	
 	state->lastPathCurrentPointers[0]=0;
 	
-	return 0;
+	return loadInternalLevels(state);
 }
 
 
@@ -130,9 +219,17 @@ the bufferNode pointer to it
 */
 BTreeNode_t* createNewNode (SystemState_t *state, enum node_t node_type )
 {
-	int currFreePos=state->memPool->currentFreePosition;
+	int currFreePos;
 	int newFreePos;
 
+	//pages released by compaction are used before the file grows
+	if(node_type!=ROOT && state->freeListHead!=0)
+		return reuseFreeNode(state,node_type);
+
+	if(state->backend==BACKEND_MMAP)
+		return createNewMappedNode(state,node_type);
+
+	currFreePos=state->memPool->currentFreePosition;
 	if(currFreePos<0 || currFreePos>MAX_NODES_INMEM)
 	{
 		printf("INVALID current free position in mem pool buffer\n");
@@ -148,8 +245,10 @@ BTreeNode_t* createNewNode (SystemState_t *state, enum node_t node_type )
 		state->memPool->nodes[0].header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
 		state->memPool->nodes[0].header.nodeID=0;
 		state->memPool->nodes[0].header.nodeType=ROOT;
+		addToPageTable(state,0,0);
 			
 		flashNodeToDisk(state,0, FALSE, TRUE);	
+		state->memPoolPointers[0].isDirty=TRUE;
 
 		state->curTreeLevel=0;
 		state->lastPath[0]=&(state->memPool->nodes[0]);
@@ -167,63 +266,271 @@ BTreeNode_t* createNewNode (SystemState_t *state, enum node_t node_type )
 	state->memPoolPointers[newFreePos].nodeID=(state->maxNodesOnDisk)++; //next ID	
 	
 	state->memPool->nodes[newFreePos].header.keysCount=0;
-	state->memPool->nodes[newFreePos].header.dataFreePosArrID=MAX_DATA_PER_NODE-1;
+	state->memPool->nodes[newFreePos].header.dataFreePosArrID=
+		(node_type==LEAF) ? LEAF_MAX_POSTING_BLOCKS-1 : MAX_DATA_PER_NODE-1;
 	state->memPool->nodes[newFreePos].header.nodeID=state->memPoolPointers[newFreePos].nodeID;
 	state->memPool->nodes[newFreePos].header.nodeType=node_type;
+	if(node_type==LEAF)	{
+		state->memPool->nodes[newFreePos].leaf.prevLeaf=0;
+		state->memPool->nodes[newFreePos].leaf.nextLeaf=0;
+	}
 
 	state->memPoolPointers[newFreePos].isOccupied=TRUE;
 	state->memPoolPointers[newFreePos].nodeID=state->memPoolPointers[newFreePos].nodeID;
+	addToPageTable(state,state->memPoolPointers[newFreePos].nodeID,newFreePos);
+	state->memPoolPointers[newFreePos].lastAccess=0;
+	markNodeUsed(state,newFreePos);
 	flashNodeToDisk(state,newFreePos, FALSE, TRUE);
+	//the new node is filled by the caller right after creation
+	state->memPoolPointers[newFreePos].isDirty=TRUE;
 	
 	state->memPool->currentFreePosition=newFreePos+1; 
+	if(node_type==INTERNAL)
+		return pinInternalNode(state,&(state->memPool->nodes[newFreePos]));
 	return &(state->memPool->nodes[newFreePos]);
 }
 
 
+/*
+takes the first node of the free list and turns it into a new node of node_type.
+The free node is read like any other node, so this works with both backends,
+and its page is already in the file - nothing is appended
+*/
+BTreeNode_t* reuseFreeNode(SystemState_t *state, enum node_t node_type)
+{
+	BTreeNode_t *node;
+	unsigned int nodeID=state->freeListHead;
+
+	node=getNode(state,nodeID);
+	if(node==NULL)
+	{
+		printf("Free node %u not found\n",nodeID);
+		return NULL;
+	}
+	if(node->header.nodeType!=FREE)
+	{
+		printf("Node %u in the free list is not free\n",nodeID);
+		return NULL;
+	}
+	state->freeListHead=node->free.nextFree;
+	state->freeNodesCount--;
+
+	node->header.keysCount=0;
+	node->header.dataFreePosArrID=(node_type==LEAF) ? LEAF_MAX_POSTING_BLOCKS-1 : MAX_DATA_PER_NODE-1;
+	node->header.nodeID=nodeID;
+	node->header.nodeType=node_type;
+	if(node_type==LEAF)	{
+		node->leaf.prevLeaf=0;
+		node->leaf.nextLeaf=0;
+	}
+	markNodeDirty(state,node);
+	if(node_type==INTERNAL)
+		return pinInternalNode(state,node);
+	return node;
+}
+
+
+/*
+releases a node which is no longer referenced by the tree: 
+it becomes the first node of the free list, and is written to disk as FREE
+*/
+void freeNode(SystemState_t *state, BTreeNode_t *node)
+{
+	node->header.nodeType=FREE;
+	node->header.keysCount=0;
+	node->free.nextFree=state->freeListHead;
+	state->freeListHead=node->header.nodeID;
+	state->freeNodesCount++;
+	markNodeDirty(state,node);
+
+	//a frame of the pinned area is given back, the free node is only needed on disk
+	if(state->backend==BACKEND_BUFFERED && node-state->memPool->nodes>=MAX_NODES_INMEM)
+	{
+		flashNodeToDisk(state,node-state->memPool->nodes,TRUE,FALSE);
+		state->memPool->pinnedNodesCount--;
+	}
+}
+
+
+/*
+moves a freshly read or created internal node from the memory pool into the pinned area,
+if the area has a free frame. Pinned frames are outside of the range scanned by the replacement policies,
+so the node is never evicted.
+Returns the node in its new place, or the node itself if it stays in the memory pool
+*/
+BTreeNode_t* pinInternalNode(SystemState_t *state, BTreeNode_t *node)
+{
+	int oldPos,newPos;
+	int i;
+
+	if(state->backend==BACKEND_MMAP)
+		return node;
+	oldPos=node-state->memPool->nodes;
+	if(oldPos>=MAX_NODES_INMEM || state->memPool->pinnedNodesCount>=MAX_PINNED_NODES)
+		return node;
+
+	for(newPos=MAX_NODES_INMEM;state->memPoolPointers[newPos].isOccupied==TRUE;newPos++)
+		;
+	memcpy(&state->memPool->nodes[newPos],node,sizeof(BTreeNode_t));
+	state->memPoolPointers[newPos]=state->memPoolPointers[oldPos];
+	state->memPoolPointers[oldPos].isOccupied=FALSE;
+	state->memPoolPointers[oldPos].isDirty=FALSE;
+	addToPageTable(state,node->header.nodeID,newPos);
+	state->memPool->pinnedNodesCount++;
+
+	//a new node may already be on the lastPath
+	for(i=0;i<=state->curTreeLevel;i++)
+	{
+		if(state->lastPath[i]==node)
+			state->lastPath[i]=&state->memPool->nodes[newPos];
+	}
+	return &state->memPool->nodes[newPos];
+}
+
+
+/*prints how many internal nodes are pinned in memory, and how much memory they take*/
+void reportPinnedLevels(SystemState_t *state)
+{
+	if(state->backend==BACKEND_MMAP)
+		return;
+	printf("Pinned internal nodes: %d of %d (%lu KB of %lu KB), the root takes another %lu KB\n",
+		state->memPool->pinnedNodesCount,MAX_PINNED_NODES,
+		(unsigned long)state->memPool->pinnedNodesCount*sizeof(BTreeNode_t)/1024,
+		(unsigned long)MAX_PINNED_NODES*sizeof(BTreeNode_t)/1024,
+		(unsigned long)sizeof(BTreeNode_t)/1024);
+}
+
+
 /*
 This routine writes to btree file the node which is in memPool at position arrPointersPos
+A node which was not modified since it was read (not dirty) is not written again
 */
 int flashNodeToDisk (SystemState_t *state, int arrPointersPos, 
 					 enum BOOL setFree, enum BOOL isNew)
 {
 	unsigned int nodeID=state->memPool->nodes[arrPointersPos].header.nodeID;
-	int res;
 
-	if(isNew==TRUE)
+	//a clean node is not written - its copy on disk is up to date
+	//a new node gets the next nodeID, so it is written at the end of file
+	if(isNew==TRUE || state->memPoolPointers[arrPointersPos].isDirty==TRUE)
 	{
-		fseek(state->btreefile, 0, SEEK_END);
+		if(writeNodeToFile(state->btreefd,&(state->memPool->nodes[arrPointersPos])))
+		{
+			printf("failed to write BTree node %u to file\n",nodeID);
+			return RESULT_ERROR;
+		}
+		state->memPoolPointers[arrPointersPos].isDirty=FALSE;
 	}
 
-	else
+	if(setFree==TRUE)
 	{
-		if(moveInBTreeFile(state->btreefile,nodeID))
+		if(arrPointersPos<0 || arrPointersPos>=MAX_NODES_INMEM+MAX_PINNED_NODES)
 		{
-			printf("error finding position in BTree file for node writing\n");
-			return RESULT_ERROR;
+			printf("Flushed to disk a node from an invalid position in buffer\n");
+			exit(1);
 		}
+		//the pinned area is not scanned by the replacement policies
+		if(arrPointersPos<MAX_NODES_INMEM)
+			state->memPool->currentFreePosition=arrPointersPos;
+		state->memPoolPointers[arrPointersPos].isOccupied=FALSE;
+		removeFromPageTable(state,nodeID);
 	}
 
+	return 0;
+}
+
 
-	res=fwrite(&(state->memPool->nodes[arrPointersPos]), sizeof (BTreeNode_t), 1, state->btreefile);
-	if(res!=1)
+/*This finds the next available spot in memory buffer 
+using the replacement policy selected in state->replacementPolicy.
+Under any policy, nodes on the lastPath are never evicted, 
+and 0 spot is reserved to the root node which is always in memory
+*/
+int getFreeSpotInBuffer(SystemState_t *state, int currFreePos)
+{
+	switch(state->replacementPolicy)
 	{
-		printf("failed to write BTree node %u to file\n",nodeID);
-		return RESULT_ERROR;
+		case REPLACE_CLOCK:
+			return getFreeSpotClock(state, currFreePos);
+		case REPLACE_LRU2:
+			return getFreeSpotLRU2(state);
+		default:
+			return getFreeSpotLastPath(state, currFreePos);
 	}
+}
 
-	rewind(state->btreefile);
-	if(setFree==TRUE)
+
+/*
+CLOCK replacement: currFreePos is the clock hand.
+A node whose reference bit is set gets a second chance - the bit is cleared 
+and the hand moves on. The first node found with the bit cleared is evicted.
+Nodes of upper levels are referenced on every descent, so they stay in memory,
+while leaves used by one bucket transfer are evicted after one sweep
+*/
+int getFreeSpotClock(SystemState_t *state, int currFreePos)
+{
+	int i,step;
+
+	if(currFreePos<1 || currFreePos>=MAX_NODES_INMEM)
+		currFreePos=1;
+
+	//after one sweep all reference bits are cleared, so 2 sweeps are enough
+	for(step=0,i=currFreePos;step<2*MAX_NODES_INMEM;step++)
 	{
-		state->memPool->currentFreePosition=arrPointersPos;
-		if(arrPointersPos<0 || arrPointersPos>=MAX_NODES_INMEM)
+		if(state->memPoolPointers[i].isOccupied==FALSE)
+			return i;
+		if(state->memPoolPointers[i].isReferenced==TRUE)
+			state->memPoolPointers[i].isReferenced=FALSE;
+		else if(canEvict(state,i)==TRUE)
 		{
-			printf("Flushed to disk a node from an invalid position in buffer\n");
-			exit(1);
+			flashNodeToDisk(state,i, TRUE, FALSE);
+			return i;
 		}
-		state->memPoolPointers[arrPointersPos].isOccupied=FALSE;
+		i++;
+		if(i==MAX_NODES_INMEM)
+			i=1;
 	}
 
-	return 0;
+	printf("Failed to find free spot in memory pool buffer\n");
+	return RESULT_NOT_FOUND; 
+}
+
+
+/*
+LRU-2 replacement: evicts the node whose second-to-last access is the oldest.
+Nodes accessed only once (prevAccess=0) are evicted first, in LRU order,
+so a node which was used by a single transfer does not push out 
+internal nodes which are used by every descent.
+The scan runs only on a miss, which is followed by the disk I/O anyway
+*/
+int getFreeSpotLRU2(SystemState_t *state)
+{
+	int i;
+	int victim=RESULT_NOT_FOUND;
+	InMemNodeInfo_t *info;
+	InMemNodeInfo_t *victimInfo=NULL;
+
+	for(i=1;i<MAX_NODES_INMEM;i++)
+	{
+		info=&state->memPoolPointers[i];
+		if(info->isOccupied==FALSE)
+			return i;
+		if(victimInfo!=NULL && (info->prevAccess>victimInfo->prevAccess
+			|| (info->prevAccess==victimInfo->prevAccess && info->lastAccess>=victimInfo->lastAccess)))
+			continue;
+		if(canEvict(state,i)==FALSE)
+			continue;
+		victim=i;
+		victimInfo=info;
+	}
+
+	if(victim==RESULT_NOT_FOUND)
+	{
+		printf("Failed to find free spot in memory pool buffer\n");
+		return RESULT_NOT_FOUND;
+	}
+
+	flashNodeToDisk(state,victim, TRUE, FALSE);
+	return victim;
 }
 
 
@@ -236,7 +543,7 @@ If it was used, we try the next spot.
 When at the end of an memPool array - we start from 1 - 
 0 spot is reserved to the root node which is always in memory
 */
-int getFreeSpotInBuffer(SystemState_t *state, int currFreePos)
+int getFreeSpotLastPath(SystemState_t *state, int currFreePos)
 {
 	int i;
 	
@@ -244,7 +551,7 @@ int getFreeSpotInBuffer(SystemState_t *state, int currFreePos)
 	{
 		if(state->memPoolPointers[i].isOccupied==FALSE)
 			return i;
-		if(isRecentlyUsed(state,state->memPoolPointers[i].nodeID)==FALSE)
+		if(canEvict(state,i)==TRUE)
 		{
 			flashNodeToDisk(state,i, TRUE, FALSE);
 			return i;
@@ -255,7 +562,7 @@ int getFreeSpotInBuffer(SystemState_t *state, int currFreePos)
 	{
 		if(state->memPoolPointers[i].isOccupied==FALSE)
 			return i;
-		if(isRecentlyUsed(state,state->memPoolPointers[i].nodeID)==FALSE)
+		if(canEvict(state,i)==TRUE)
 		{
 			flashNodeToDisk(state,i, TRUE, FALSE);
 			return i;
@@ -267,6 +574,17 @@ int getFreeSpotInBuffer(SystemState_t *state, int currFreePos)
 }
 
 
+/*node can be evicted if it is not pinned (read in progress, or held by the caller) and not on the lastPath*/
+enum BOOL canEvict(SystemState_t *state, int memPoolPos)
+{
+	if(state->memPoolPointers[memPoolPos].isPinned==TRUE)
+		return FALSE;
+	if(isRecentlyUsed(state,state->memPoolPointers[memPoolPos].nodeID)==TRUE)
+		return FALSE;
+	return TRUE;
+}
+
+
 /*keep the node in memory pool if it was recently used and stored in lastPath*/
 enum BOOL isRecentlyUsed(SystemState_t *state, unsigned int nodeID)
 {	
@@ -287,15 +605,18 @@ and puts into a free spot in memory pool
 BTreeNode_t* getNode(SystemState_t *state, unsigned int nodeID)
 {
 	// gets handler to a node by its ID
-	//first looks into state->memPoolPointers
+	//first looks into state->pageTable
 	//if not found - loadNodeFromDisk
-	int i;
-	for(i=0;i<MAX_NODES_INMEM;i++)
+	int memPoolPos;
+
+	if(state->backend==BACKEND_MMAP)
+		return getMappedNode(state,nodeID);
+
+	memPoolPos=findInPageTable(state,nodeID);
+	if(memPoolPos!=RESULT_NOT_FOUND)
 	{
-		if(state->memPoolPointers[i].nodeID==nodeID)
-		{
-			return &(state->memPool->nodes[i]);
-		}
+		markNodeUsed(state,memPoolPos);
+		return &(state->memPool->nodes[memPoolPos]);
 	}
 
 	//if not in mem - load from disk
@@ -304,11 +625,10 @@ BTreeNode_t* getNode(SystemState_t *state, unsigned int nodeID)
 
 
 /*Loads node from disk into free spot 
-Moves in btree file nodeID positions, nodeID corresponds to the position of a node in BTree file
+nodeID corresponds to the position of a node in BTree file, the node is read with one pread
 */
 BTreeNode_t* loadNodeFromDisk (SystemState_t *state, unsigned int nodeID)
 {
-	int res;
 	//we are  loading node into free spot 
 	int currFreePos=state->memPool->currentFreePosition;
 	int newFreePos;
@@ -323,37 +643,139 @@ BTreeNode_t* loadNodeFromDisk (SystemState_t *state, unsigned int nodeID)
 	newFreePos=getFreeSpotInBuffer(state, currFreePos);
 	
 	//we read node nodeID into free spot
-	rewind(state->btreefile);
-	if(moveInBTreeFile(state->btreefile,nodeID))
-	{
-		printf("error finding position in BTree file for node reading\n");
-		return NULL;
-	}
-
-	res=fread(&state->memPool->nodes[newFreePos],sizeof(BTreeNode_t),1,state->btreefile);
-	if(res!=1)
+	if(readNodesFromFile(state->btreefd,nodeID,1,&state->memPool->nodes[newFreePos]))
 	{
 		printf("error reading node %u in BTree file\n",nodeID);
 		return NULL;
 	}
 	
-	rewind(state->btreefile);
 	state->memPoolPointers[newFreePos].nodeID=nodeID;
 	state->memPoolPointers[newFreePos].isOccupied=TRUE;
+	state->memPoolPointers[newFreePos].isDirty=FALSE;
+	addToPageTable(state,nodeID,newFreePos);
+	state->memPoolPointers[newFreePos].lastAccess=0;
+	markNodeUsed(state,newFreePos);
 
 	state->memPool->currentFreePosition=newFreePos+1;
+	if(state->memPool->nodes[newFreePos].header.nodeType==INTERNAL)
+		return pinInternalNode(state,&state->memPool->nodes[newFreePos]);
 	return &state->memPool->nodes[newFreePos];
 }
 
 
 /*
-writes in-memory nodes which labeled as occupied 
-	(they may have undergone changes since they were read) to disk
+Loads several nodes in one batch: a free spot is reserved for each node which is not in memory pool,
+then all reads are issued together by the asynchronous reader, so their latencies overlap.
+Reserved spots are pinned until the batch completes, so they cannot be given away 
+to the next node of the same batch
+*/
+int prefetchNodes(SystemState_t *state, unsigned int *nodeIDs, int nodesCount)
+{
+	unsigned int toRead[ASYNC_READ_QUEUE_DEPTH];
+	BTreeNode_t *targets[ASYNC_READ_QUEUE_DEPTH];
+	int positions[ASYNC_READ_QUEUE_DEPTH];
+	int i,readCount=0;
+	int newFreePos;
+	int res;
+
+	if(state->backend==BACKEND_MMAP)
+	{
+		adviseMappedNodes(state,nodeIDs,nodesCount);
+		return 0;
+	}
+
+	for(i=0;i<nodesCount && readCount<ASYNC_READ_QUEUE_DEPTH;i++)
+	{
+		if(nodeIDs[i]>=state->maxNodesOnDisk || findInPageTable(state,nodeIDs[i])!=RESULT_NOT_FOUND)
+			continue;
+
+		newFreePos=getFreeSpotInBuffer(state, state->memPool->currentFreePosition);
+		if(newFreePos==RESULT_NOT_FOUND)
+			break;
+
+		state->memPoolPointers[newFreePos].nodeID=nodeIDs[i];
+		state->memPoolPointers[newFreePos].isOccupied=TRUE;
+		state->memPoolPointers[newFreePos].isDirty=FALSE;
+		state->memPoolPointers[newFreePos].isPinned=TRUE;
+		addToPageTable(state,nodeIDs[i],newFreePos);
+		state->memPoolPointers[newFreePos].lastAccess=0;
+		markNodeUsed(state,newFreePos);
+		state->memPool->currentFreePosition=newFreePos+1;
+
+		toRead[readCount]=nodeIDs[i];
+		targets[readCount]=&state->memPool->nodes[newFreePos];
+		positions[readCount]=newFreePos;
+		readCount++;
+	}
+
+	res=readNodesAsync(&state->asyncReader,state->btreefd,toRead,targets,readCount);
+
+	for(i=0;i<readCount;i++)
+	{
+		state->memPoolPointers[positions[i]].isPinned=FALSE;
+		if(res)
+		{
+			//spot is released, the node will be read again on demand
+			state->memPoolPointers[positions[i]].isOccupied=FALSE;
+			removeFromPageTable(state,toRead[i]);
+		}
+		else if(targets[i]->header.nodeType==INTERNAL)
+			pinInternalNode(state,targets[i]);
+	}
+	return res;
+}
+
+
+/*
+records an access to the node at position memPoolPos 
+for the replacement policy: sets CLOCK reference bit and shifts LRU-2 access times
+*/
+void markNodeUsed(SystemState_t *state, int memPoolPos)
+{
+	InMemNodeInfo_t *info=&state->memPoolPointers[memPoolPos];
+
+	info->isReferenced=TRUE;
+	info->prevAccess=info->lastAccess;
+	info->lastAccess=++(state->accessCounter);
+}
+
+
+/*labels the node as modified, so it is written back to disk when it leaves memory pool*/
+void markNodeDirty(SystemState_t *state, BTreeNode_t *node)
+{
+	//mapped pages are tracked by the kernel
+	if(state->backend==BACKEND_MMAP)
+		return;
+	state->memPoolPointers[node - state->memPool->nodes].isDirty=TRUE;
+}
+
+
+/*
+keeps the node in memory pool while the caller still uses it, though it is not on the lastPath -
+e.g. the first of two new nodes while the second one is created. hold=FALSE releases the node
+*/
+void holdNodeInMemory(SystemState_t *state, BTreeNode_t *node, enum BOOL hold)
+{
+	//mapped pages are not evicted by the program
+	if(state->backend==BACKEND_MMAP)
+		return;
+	state->memPoolPointers[node - state->memPool->nodes].isPinned=hold;
+}
+
+
+/*
+writes in-memory nodes which labeled as occupied and dirty
+	(they have undergone changes since they were read) to disk
 	*/
 int finish_SynchronizeData(SystemState_t *state)
 {	
 	int i;
-	for(i=0;i<MAX_NODES_INMEM;i++)
+
+	if(state->backend==BACKEND_MMAP)
+		return syncMappedBTree(state);
+
+	closeAsyncReader(&state->asyncReader);
+	for(i=0;i<MAX_NODES_INMEM+MAX_PINNED_NODES;i++)
 	{
 		if(state->memPoolPointers[i].isOccupied==TRUE)
 		{
@@ -363,3 +785,85 @@ int finish_SynchronizeData(SystemState_t *state)
 	}
 	return 0;
 }
+
+
+/*
+Page table is an open-addressing hash table (linear probing) 
+which maps nodeID of each node currently in memory pool to its position in memory pool.
+It is kept in sync by createNewNode, loadNodeFromDisk and flashNodeToDisk
+*/
+static int getPageTableHome(unsigned int nodeID)
+{
+	//multiplication by an odd constant is a bijection modulo 2^k, 
+	//so consecutive node IDs never collide
+	return (int)((nodeID*2654435761u)&(PAGE_TABLE_SIZE-1));
+}
+
+
+/*returns position of node nodeID in memory pool or RESULT_NOT_FOUND*/
+int findInPageTable(SystemState_t *state, unsigned int nodeID)
+{
+	int i=getPageTableHome(nodeID);
+
+	while(state->pageTable[i].memPoolPos!=PAGE_TABLE_EMPTY)
+	{
+		if(state->pageTable[i].nodeID==nodeID)
+			return state->pageTable[i].memPoolPos;
+		i=(i+1)&(PAGE_TABLE_SIZE-1);
+	}
+	return RESULT_NOT_FOUND;
+}
+
+
+/*adds mapping nodeID -> memPoolPos, or updates it if nodeID is already there*/
+int addToPageTable(SystemState_t *state, unsigned int nodeID, int memPoolPos)
+{
+	int i=getPageTableHome(nodeID);
+
+	while(state->pageTable[i].memPoolPos!=PAGE_TABLE_EMPTY)
+	{
+		if(state->pageTable[i].nodeID==nodeID)
+			break;
+		i=(i+1)&(PAGE_TABLE_SIZE-1);
+	}
+
+	state->pageTable[i].nodeID=nodeID;
+	state->pageTable[i].memPoolPos=memPoolPos;
+	return 0;
+}
+
+
+/*
+removes nodeID from page table.
+The following entries of the same probe sequence are shifted back into the freed spot,
+so no deleted markers are needed and lookups stay short
+*/
+int removeFromPageTable(SystemState_t *state, unsigned int nodeID)
+{
+	int i=getPageTableHome(nodeID);
+	int j,home;
+
+	while(state->pageTable[i].memPoolPos!=PAGE_TABLE_EMPTY)
+	{
+		if(state->pageTable[i].nodeID==nodeID)
+			break;
+		i=(i+1)&(PAGE_TABLE_SIZE-1);
+	}
+
+	if(state->pageTable[i].memPoolPos==PAGE_TABLE_EMPTY)
+		return RESULT_NOT_FOUND;
+
+	for(j=(i+1)&(PAGE_TABLE_SIZE-1);state->pageTable[j].memPoolPos!=PAGE_TABLE_EMPTY;
+		j=(j+1)&(PAGE_TABLE_SIZE-1))
+	{
+		home=getPageTableHome(state->pageTable[j].nodeID);
+		//entry j stays if its home is cyclically in (i,j]
+		if(i<=j ? (i<home && home<=j) : (i<home || home<=j))
+			continue;
+		state->pageTable[i]=state->pageTable[j];
+		i=j;
+	}
+
+	state->pageTable[i].memPoolPos=PAGE_TABLE_EMPTY;
+	return 0;
+}
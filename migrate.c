@@ -0,0 +1,190 @@
+#include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+Converts a B-tree file written with the old leaf layout, where keys and document chains
+are interleaved in one Data_t array, into a new B-tree file with LeafPage_t leaves.
+
+The old tree is traversed in key order, and the (key, docID) pairs of its leaves
+are inserted into the new tree in sorted batches, as if they came from buffer buckets.
+The new leaves have a different capacity, so the new tree is rebuilt and not converted page by page.
+Old nodes always have LEGACY_PAGE_SIZE bytes, the new tree gets the page size of this build
+(migrate_<N>k is built for other page sizes, as onlineupdate_<N>k).
+
+To run: ./migrate <oldbtreefile> <newbtreefile>
+The size file <newbtreefile>_size is created next to the new B-tree file
+*/
+int transfercounter;
+
+#define MIGRATE_RUN_MAX DEFAULT_KEYS_PER_BUCKET //pairs inserted into the new tree in one batch
+#define LEGACY_MAX_DATA_PER_NODE ((LEGACY_PAGE_SIZE-sizeof(NodeHeader_t))/sizeof(Data_t))
+
+typedef struct
+{
+	NodeHeader_t header;
+	Data_t data[LEGACY_MAX_DATA_PER_NODE];
+}LegacyNode_t; //node of the old B-tree file, independent of BTREE_PAGE_SIZE
+
+typedef struct
+{
+	int oldfd;
+	LegacyNode_t levels[MAX_TREE_HEIGHT]; //path of old nodes from the root to the current leaf
+	Data_t run[MIGRATE_RUN_MAX];
+	int runCount;
+	unsigned int leavesCount;
+	unsigned long pairsCount;
+}Migration_t;
+
+static int flushRun(SystemState_t *state, Migration_t *migration)
+{
+	if(migration->runCount==0)
+		return RESULT_OK;
+	if(insertSortedBatchFromBuffer(state, migration->run, migration->runCount))
+		return RESULT_ERROR;
+	migration->pairsCount+=migration->runCount;
+	migration->runCount=0;
+	return RESULT_OK;
+}
+
+static int readLegacyNode(int oldfd, unsigned int nodeID, LegacyNode_t *node)
+{
+	size_t done=0;
+	off_t offset=(off_t)nodeID*(off_t)sizeof(LegacyNode_t);
+	ssize_t res;
+
+	while(done<sizeof(LegacyNode_t))
+	{
+		res=pread(oldfd,(char *)node+done,sizeof(LegacyNode_t)-done,offset+done);
+		if(res<=0)
+		{
+			if(res<0 && errno==EINTR)
+				continue;
+			printf("error reading node %u from old BTree file: %s\n",nodeID,
+				res<0 ? strerror(errno) : "unexpected end of file");
+			return RESULT_ERROR;
+		}
+		done+=res;
+	}
+	return 0;
+}
+
+/*
+old leaf: data[0..keysCount-1] are keys, data[key].pointer is the position of the first document,
+documents are chained through pointer, 0 ends the chain
+*/
+static int migrateOldLeaf(SystemState_t *state, Migration_t *migration, LegacyNode_t *oldLeaf)
+{
+	int i;
+	int docPos;
+
+	for(i=0;i<oldLeaf->header.keysCount;i++)	{
+		docPos=oldLeaf->data[i].pointer;
+		while(docPos!=0)	{
+			if(docPos<=oldLeaf->header.dataFreePosArrID || docPos>=(int)LEGACY_MAX_DATA_PER_NODE)	{
+				printf("Invalid document position %d in old leaf %u\n",docPos,oldLeaf->header.nodeID);
+				return RESULT_ERROR;
+			}
+			if(migration->runCount==MIGRATE_RUN_MAX && flushRun(state, migration))
+				return RESULT_ERROR;
+			migration->run[migration->runCount].value=oldLeaf->data[i].value;
+			migration->run[migration->runCount].pointer=oldLeaf->data[docPos].value;
+			migration->runCount++;
+			docPos=oldLeaf->data[docPos].pointer;
+		}
+	}
+	migration->leavesCount++;
+	return RESULT_OK;
+}
+
+/*visits the old subtree of nodeID in key order*/
+static int migrateOldSubtree(SystemState_t *state, Migration_t *migration, unsigned int nodeID, int level)
+{
+	LegacyNode_t *node;
+	int i;
+
+	if(level>=MAX_TREE_HEIGHT)	{
+		printf("Old B-tree is deeper than %d levels\n",MAX_TREE_HEIGHT);
+		return RESULT_ERROR;
+	}
+
+	node=&migration->levels[level];
+	if(readLegacyNode(migration->oldfd, nodeID, node))
+		return RESULT_ERROR;
+
+	if(node->header.nodeType==LEAF)
+		return migrateOldLeaf(state, migration, node);
+
+	for(i=0;i<node->header.keysCount;i++)	{
+		if(migrateOldSubtree(state, migration, node->data[i].pointer, level+1))
+			return RESULT_ERROR;
+		//children are read into the deeper levels, so this node stays in place
+	}
+	return RESULT_OK;
+}
+
+int main(int argc, char *argv[])
+{
+	SystemState_t state;
+	Migration_t *migration;
+	char sizeFileName[MAX_PATH_LENGTH];
+	FILE *sizefile;
+
+	if(argc<3)	{
+		printf("To run: ./migrate <oldbtreefile> <newbtreefile>\n");
+		return RESULT_ERROR;
+	}
+	if(snprintf(sizeFileName,sizeof(sizeFileName),"%s_size", argv[2])>=(int)sizeof(sizeFileName))	{
+		printf("BTree file name %s is too long\n",argv[2]);
+		return RESULT_ERROR;
+	}
+
+	migration=(Migration_t *) calloc (1, sizeof(Migration_t));
+	if(migration==NULL)	{
+		printf("Failed to allocate memory for migration state of size: %lu \n",sizeof(Migration_t));
+		return RESULT_ERROR;
+	}
+
+	if((migration->oldfd=open(argv[1], O_RDONLY))<0)	{
+		printf("Could not open old BTree file %s \n",argv[1]);
+		return RESULT_ERROR;
+	}
+
+	//the new B-tree is created from scratch, an existing file is never overwritten
+	memset(&state,0,sizeof(SystemState_t));
+	state.replacementPolicy=REPLACE_CLOCK;
+	state.backend=BACKEND_BUFFERED;
+	//keys come in order: leaves are cut 90/10 where keys are appended, not in half
+	state.splitPolicy=SPLIT_APPEND;
+	if((state.btreefd=open(argv[2], O_RDWR | O_CREAT | O_EXCL, 0644))<0)	{
+		printf("Could not create new BTree file %s - it should not exist\n",argv[2]);
+		return RESULT_ERROR;
+	}
+	if(!(sizefile= fopen ( sizeFileName , "w+b" )))	{
+		printf("Could not create new size file %s \n",sizeFileName);
+		return RESULT_ERROR;
+	}
+	state.sizefile=sizefile;
+
+	if(initMemoryPool(&state))
+		return RESULT_ERROR;
+
+	if(migrateOldSubtree(&state, migration, 0, 0) || flushRun(&state, migration))	{
+		printf("Failed to migrate BTree file %s\n",argv[1]);
+		return RESULT_ERROR;
+	}
+
+	finish_SynchronizeData(&state);
+	close(state.btreefd);
+	close(migration->oldfd);
+
+	if(writeBTreeSize(sizefile,state.maxNodesOnDisk,state.freeListHead,state.freeNodesCount))
+		return RESULT_ERROR;
+	fclose(sizefile);
+
+	printf("Migrated %lu documents from %u leaves into %u nodes\n",
+		migration->pairsCount,migration->leavesCount,state.maxNodesOnDisk);
+	return RESULT_OK;
+}
@@ -0,0 +1,199 @@
+#include "general.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+Memory-mapped backend of the memory pool.
+B-tree file is mapped with MAP_SHARED, and getNode returns a pointer straight into the mapping,
+so there is no copying of nodes to and from MemoryPool_t.
+The kernel page cache plays the role of the memory pool: it decides what to evict,
+and writes back the modified pages. We only give it hints with madvise 
+and force write-back with msync at the end.
+
+Virtual address space for MMAP_MAX_NODES nodes is reserved at start, 
+and the file is mapped into it piece by piece as it grows,
+so the node pointers kept in lastPath stay valid when the B-tree grows.
+*/
+
+/*
+makes sure that the nodes with IDs 0..nodesCount-1 are mapped.
+The file is extended and mapped in chunks of MMAP_GROW_BYTES
+*/
+static int growMappedBTree(SystemState_t *state, unsigned int nodesCount)
+{
+	size_t neededBytes=(size_t)nodesCount*sizeof(BTreeNode_t);
+	size_t newBytes;
+	void *res;
+
+	if(neededBytes<=state->mappedBytes)
+		return 0;
+
+	if(nodesCount>MMAP_MAX_NODES)
+	{
+		printf("B-tree of %u nodes does not fit into mapping reserved for %d nodes\n",
+			nodesCount,MMAP_MAX_NODES);
+		return RESULT_ERROR;
+	}
+
+	newBytes=((neededBytes+MMAP_GROW_BYTES-1)/MMAP_GROW_BYTES)*MMAP_GROW_BYTES;
+
+	if(ftruncate(state->btreefd,(off_t)newBytes))
+	{
+		printf("Failed to extend BTree file to %lu bytes: %s\n",
+			(unsigned long)newBytes,strerror(errno));
+		return RESULT_ERROR;
+	}
+
+	res=mmap((char *)state->mappedNodes+state->mappedBytes, newBytes-state->mappedBytes,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, state->btreefd, (off_t)state->mappedBytes);
+	if(res==MAP_FAILED)
+	{
+		printf("Failed to map BTree file: %s\n",strerror(errno));
+		return RESULT_ERROR;
+	}
+
+	//nodes are visited in random order, sequential read-ahead only pollutes page cache
+	madvise(res,newBytes-state->mappedBytes,MADV_RANDOM);
+	state->mappedBytes=newBytes;
+	return 0;
+}
+
+
+/*
+reserves address space, maps existing B-tree file 
+and creates root node if the file is empty
+*/
+int initMappedBTree(SystemState_t *state)
+{
+	unsigned int nodesInFile;
+	void *reserved;
+
+	reserved=mmap(NULL,(size_t)MMAP_MAX_NODES*sizeof(BTreeNode_t),PROT_NONE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(reserved==MAP_FAILED)
+	{
+		printf("Failed to reserve address space for %d mapped BTree nodes: %s\n",
+			MMAP_MAX_NODES,strerror(errno));
+		return 1;
+	}
+
+	state->mappedNodes=(BTreeNode_t *)reserved;
+	state->mappedBytes=0;
+	state->mappedPageSize=(size_t)sysconf(_SC_PAGESIZE);
+
+	nodesInFile=getBTreeSize(state);
+	state->maxNodesOnDisk=nodesInFile;
+	if(growMappedBTree(state,nodesInFile+1))
+		return 1;
+
+	state->curTreeLevel=0;
+	state->lastPathCurrentPointers[0]=0;
+
+	if(nodesInFile==0)
+	{
+		createNewMappedNode(state,ROOT);
+		state->maxNodesOnDisk++;
+		return 0;
+	}
+
+	printf("There were %d nodes in an existing BTree file\n",nodesInFile);
+	state->lastPath[0]=&state->mappedNodes[0];
+	return 0;
+}
+
+
+/*returns pointer to the node inside the mapping*/
+BTreeNode_t* getMappedNode(SystemState_t *state, unsigned int nodeID)
+{
+	if(nodeID>=state->maxNodesOnDisk)
+	{
+		printf("Node %u is outside of the mapped B-tree of %u nodes\n",nodeID,state->maxNodesOnDisk);
+		return NULL;
+	}
+	return &state->mappedNodes[nodeID];
+}
+
+
+/*
+asks the kernel to read in the pages of the nodes which are going to be visited.
+Consecutive node IDs are merged, so there is one madvise per range of nodes, not per node
+*/
+void adviseMappedNodes(SystemState_t *state, unsigned int *nodeIDs, int nodesCount)
+{
+	unsigned int firstID,lastID;
+	size_t start;
+	int i=0;
+
+	while(i<nodesCount)
+	{
+		firstID=lastID=nodeIDs[i++];
+		while(i<nodesCount && nodeIDs[i]==lastID+1)
+			lastID=nodeIDs[i++];
+		if(lastID>=state->maxNodesOnDisk)
+			continue;
+
+		start=(size_t)&state->mappedNodes[firstID] & ~(state->mappedPageSize-1);
+		madvise((void *)start,(size_t)&state->mappedNodes[lastID+1]-start,MADV_WILLNEED);
+	}
+}
+
+
+/*creates new node at the end of the mapped file*/
+BTreeNode_t* createNewMappedNode(SystemState_t *state, enum node_t node_type)
+{
+	BTreeNode_t *node;
+	unsigned int nodeID;
+
+	//root is created only once - when there is no root node
+	nodeID=(node_type==ROOT) ? 0 : state->maxNodesOnDisk;
+
+	if(growMappedBTree(state,nodeID+1))
+		return NULL;
+	if(node_type!=ROOT)
+		state->maxNodesOnDisk++;
+
+	node=&state->mappedNodes[nodeID];
+	node->header.keysCount=0;
+	node->header.dataFreePosArrID=(node_type==LEAF) ? LEAF_MAX_POSTING_BLOCKS-1 : MAX_DATA_PER_NODE-1;
+	node->header.nodeID=nodeID;
+	node->header.nodeType=node_type;
+	if(node_type==LEAF)	{
+		node->leaf.prevLeaf=0;
+		node->leaf.nextLeaf=0;
+	}
+
+	if(node_type==ROOT)
+	{
+		state->curTreeLevel=0;
+		state->lastPath[0]=node;
+		state->lastPathCurrentPointers[0]=0;
+	}
+	return node;
+}
+
+
+/*
+writes back all modified pages, unmaps the file 
+and cuts the unused tail which was allocated for growth
+*/
+int syncMappedBTree(SystemState_t *state)
+{
+	if(msync(state->mappedNodes,state->mappedBytes,MS_SYNC))
+	{
+		printf("Failed to sync mapped BTree file: %s\n",strerror(errno));
+		return RESULT_ERROR;
+	}
+
+	munmap(state->mappedNodes,(size_t)MMAP_MAX_NODES*sizeof(BTreeNode_t));
+	state->mappedNodes=NULL;
+	state->mappedBytes=0;
+
+	if(ftruncate(state->btreefd,getNodeOffset(state->maxNodesOnDisk)))
+	{
+		printf("Failed to truncate BTree file to %u nodes: %s\n",state->maxNodesOnDisk,strerror(errno));
+		return RESULT_ERROR;
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include "general.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+Search for a key position inside a B-tree node.
+Keys in a node are sorted, so instead of a linear scan we use 
+exponential (galloping) search from the position where the previous search stopped,
+followed by branchless binary search.
+Keys come from the buffer in sorted order, so the next key is usually close to 
+the previous position, and galloping finds it in a few steps;
+a key far away costs O(log n) comparisons instead of O(n).
+Leaves keep keys in a separate contiguous array: there the last few keys 
+are compared with one SSE2 instruction instead of the last dependent steps of the binary search
+*/
+
+#define VECTOR_SCAN_KEYS 4 //the last range of keys is compared with one vector instruction
+
+/*
+returns the first position in data[from..to-1] whose value is >= key,
+or to if all values are smaller
+*/
+int findFirstNotLess(Data_t *data, int from, int to, unsigned int key)
+{
+	int bound=1;
+	int lo,hi,half,n;
+	Data_t *base;
+
+	if(from>=to || data[from].value>=key)
+		return from;
+
+	//galloping: data[from+bound/2] < key is known at every step
+	while(from+bound<to && data[from+bound].value<key)
+		bound<<=1;
+
+	lo=from+bound/2+1;
+	hi=MIN(from+bound,to);
+	if(lo>=hi)
+		return hi;
+
+	//branchless binary search in [lo,hi): compiles into conditional moves
+	base=&data[lo];
+	n=hi-lo;
+	while(n>1)	{
+		half=n/2;
+		base=(base[half].value<key) ? base+half : base;
+		n-=half;
+	}
+	return (int)(base-data)+(base->value<key);
+}
+
+/*the original linear scan, kept as the reference for benchsearch*/
+int findFirstNotLessLinear(Data_t *data, int from, int to, unsigned int key)
+{
+	int i;
+	for(i=from;i<to;i++)	{
+		if(data[i].value>=key)
+			return i;
+	}
+	return to;
+}
+
+/*counts keys smaller than key in keys[0..n-1]*/
+static int countLessKeys(unsigned int *keys, int n, unsigned int key)
+{
+	int i=0,count=0;
+#ifdef __SSE2__
+	//SSE2 compares signed integers: flipping the sign bit turns unsigned order into signed order
+	__m128i sign=_mm_set1_epi32((int)0x80000000);
+	__m128i pivot=_mm_xor_si128(_mm_set1_epi32((int)key),sign);
+	__m128i less;
+
+	for(;i+4<=n;i+=4)	{
+		less=_mm_cmplt_epi32(_mm_xor_si128(_mm_loadu_si128((__m128i *)&keys[i]),sign),pivot);
+		count+=__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+	}
+#endif
+	for(;i<n;i++)
+		count+=(keys[i]<key);
+	return count;
+}
+
+/*
+the same as findFirstNotLess, for a contiguous array of keys of a leaf
+*/
+int findFirstNotLessKey(unsigned int *keys, int from, int to, unsigned int key)
+{
+	int bound=1;
+	int lo,hi,half,n;
+	unsigned int *base;
+
+	if(from>=to || keys[from]>=key)
+		return from;
+
+	//galloping: keys[from+bound/2] < key is known at every step
+	while(from+bound<to && keys[from+bound]<key)
+		bound<<=1;
+
+	lo=from+bound/2+1;
+	hi=MIN(from+bound,to);
+
+	//branchless binary search until the range is short enough for a vector scan
+	base=&keys[lo];
+	n=hi-lo;
+	while(n>VECTOR_SCAN_KEYS)	{
+		half=n/2;
+		base=(base[half]<key) ? base+half : base;
+		n-=half;
+	}
+	//keys are sorted, so the number of smaller keys is the offset of the first key not less
+	return (int)(base-keys)+countLessKeys(base,n,key);
+}
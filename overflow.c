@@ -0,0 +1,183 @@
+#include "general.h"
+#include <string.h>
+
+/**
+Overflow posting pages of heavy-hitter keys.
+When a key collects OVERFLOW_THRESHOLD_DOCS documents, its varints are moved from the leaf blocks
+into an OVERFLOW node of the B-tree file, and the leaf blocks are released by compacting the leaf.
+Further documents of the key are appended to the last page of its chain, which is a sequential write,
+instead of filling the leaf and splitting it into leaves with the same single key.
+Overflow pages are ordinary nodes: they are created with createNewNode and cached by the memory pool.
+
+The first page of a chain stores the ID of the last page, so an append costs at most two page accesses,
+and usually both pages are in memory
+*/
+
+static void initOverflowPage(BTreeNode_t *page)
+{
+	page->overflow.nextPage=0;
+	page->overflow.lastPage=page->header.nodeID;
+	page->overflow.usedBytes=0;
+}
+
+/*
+writes code bytes to the end of the chain which starts with firstPageID,
+adding a new page when the last one is full
+*/
+static int appendOverflowBytes(SystemState_t *state, unsigned int firstPageID, unsigned char *code, int codeBytes)
+{
+	BTreeNode_t *page;
+	unsigned int lastPageID;
+	unsigned int newPageID;
+	int written;
+
+	page=getNode(state, firstPageID);
+	if(page==NULL)	{
+		printf("Overflow page %u not found\n",firstPageID);
+		return RESULT_ERROR;
+	}
+	lastPageID=page->overflow.lastPage;
+	if(lastPageID!=firstPageID && (page=getNode(state, lastPageID))==NULL)	{
+		printf("Last overflow page %u not found\n",lastPageID);
+		return RESULT_ERROR;
+	}
+
+	written=MIN((unsigned int)codeBytes, OVERFLOW_PAGE_BYTES-page->overflow.usedBytes);
+	memcpy(&page->overflow.bytes[page->overflow.usedBytes], code, written);
+	page->overflow.usedBytes+=written;
+	markNodeDirty(state,page);
+	if(written==codeBytes)
+		return RESULT_OK;
+
+	//the last page is full - the rest of the varint goes to a new page
+	page=createNewNode(state, OVERFLOW);
+	if(page==NULL)	{
+		printf("Failed to create new overflow page\n");
+		return RESULT_ERROR;
+	}
+	initOverflowPage(page);
+	newPageID=page->header.nodeID;
+	memcpy(page->overflow.bytes, &code[written], codeBytes-written);
+	page->overflow.usedBytes=codeBytes-written;
+	markNodeDirty(state,page);
+
+	//pages are fetched again: the new page may have taken their place in the memory pool
+	if((page=getNode(state, lastPageID))==NULL)
+		return RESULT_ERROR;
+	page->overflow.nextPage=newPageID;
+	markNodeDirty(state,page);
+
+	if((page=getNode(state, firstPageID))==NULL)
+		return RESULT_ERROR;
+	page->overflow.lastPage=newPageID;
+	markNodeDirty(state,page);
+	return RESULT_OK;
+}
+
+/*
+appends document ID to the posting list of the key, in the leaf blocks or in the overflow pages.
+The leaf must be on the lastPath, so that reading overflow pages does not evict it
+*/
+int addDocumentToKey(SystemState_t *state, BTreeNode_t *leaf,
+					 PostingHeader_t *postingHeader, unsigned int docID)
+{
+	unsigned char code[POSTING_VARINT_MAX_BYTES];
+	int codeBytes;
+
+	if(postingHeader->lastBlockBytes!=POSTINGS_IN_OVERFLOW)
+		return appendPosting(leaf, postingHeader, docID);
+
+	codeBytes=encodePosting(postingHeader, docID, code);
+	if(appendOverflowBytes(state, postingHeader->overflowPage, code, codeBytes))
+		return RESULT_ERROR;
+
+	postingHeader->docsCount++;
+	postingHeader->lastDocID=docID;
+	return RESULT_OK;
+}
+
+/*moves the varints of the key from the leaf blocks into a new overflow page*/
+static int movePostingsToOverflow(SystemState_t *state, BTreeNode_t *leaf, PostingHeader_t *postingHeader)
+{
+	BTreeNode_t *page;
+	short pos;
+	int bytes;
+
+	page=createNewNode(state, OVERFLOW);
+	if(page==NULL)	{
+		printf("Failed to create new overflow page for leaf %u\n",leaf->header.nodeID);
+		return RESULT_ERROR;
+	}
+	initOverflowPage(page);
+
+	//the whole leaf heap is smaller than an overflow page
+	for(pos=postingHeader->firstBlock;pos!=0;pos=leaf->leaf.postings[pos].next)	{
+		bytes=(pos==postingHeader->lastBlock) ? postingHeader->lastBlockBytes : POSTING_BLOCK_BYTES;
+		memcpy(&page->overflow.bytes[page->overflow.usedBytes], leaf->leaf.postings[pos].bytes, bytes);
+		page->overflow.usedBytes+=bytes;
+	}
+	markNodeDirty(state,page);
+
+	postingHeader->overflowPage=page->header.nodeID;
+	postingHeader->lastBlockBytes=POSTINGS_IN_OVERFLOW;
+	return RESULT_OK;
+}
+
+/*
+moves posting lists which reached OVERFLOW_THRESHOLD_DOCS to overflow pages,
+and compacts the leaf blocks if any list was moved
+*/
+int moveHeavyKeysToOverflow(SystemState_t *state, BTreeNode_t *leaf)
+{
+	PostingHeader_t *postingHeader;
+	int i;
+	int moved=0;
+
+	for(i=0;i<leaf->header.keysCount;i++)	{
+		postingHeader=&leaf->leaf.postingHeaders[i];
+		if(postingHeader->lastBlockBytes!=POSTINGS_IN_OVERFLOW
+			&& postingHeader->docsCount>=OVERFLOW_THRESHOLD_DOCS)	{
+			if(movePostingsToOverflow(state, leaf, postingHeader))
+				return RESULT_ERROR;
+			moved++;
+		}
+	}
+
+	if(moved==0)
+		return RESULT_OK;
+	markNodeDirty(state,leaf);
+	return compactPostings(leaf);
+}
+
+/*
+decodes all documents of the key into docIDs, which must hold docsCount elements.
+Returns the number of decoded documents
+*/
+int decodeKeyPostings(SystemState_t *state, LeafPage_t *page,
+					  PostingHeader_t *postingHeader, unsigned int *docIDs)
+{
+	PostingDecoder_t decoder={0,0,0};
+	PostingHeader_t header=*postingHeader; //the leaf may leave the memory pool while pages are read
+	BTreeNode_t *overflowPage;
+	unsigned int pageID;
+	int count=0;
+
+	if(header.lastBlockBytes!=POSTINGS_IN_OVERFLOW)
+		return decodePostings(page, &header, docIDs);
+
+	pageID=header.overflowPage;
+	while(pageID!=0 && count<header.docsCount)	{
+		overflowPage=getNode(state, pageID);
+		if(overflowPage==NULL)	{
+			printf("Overflow page %u not found\n",pageID);
+			return count;
+		}
+		count+=decodePostingBytes(&decoder, overflowPage->overflow.bytes,
+			overflowPage->overflow.usedBytes, &docIDs[count]);
+		pageID=overflowPage->overflow.nextPage;
+	}
+
+	if(count!=header.docsCount)
+		printf("Overflow posting list is broken: decoded %d documents of %d\n",count,header.docsCount);
+	return count;
+}
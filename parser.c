@@ -152,6 +152,47 @@ int removeDuplicates(unsigned int *hashedwords,int totalwords, int *distinctWord
 
 
 
+/*
+reads one document from fileName and leaves its distinct word hashes sorted in hashedwords.
+inputbuffer holds INPUT_BUFFER_MAX characters, hashedwords and tempArray as many hashes
+*/
+int readDocumentWords(char *fileName, char *inputbuffer, unsigned int *hashedwords,
+					  unsigned int *tempArray, int *distinctWords) {
+	FILE *inputfile;
+	int totalChars;
+	int totalwords;
+	int res;
+
+	if(!(inputfile= fopen ( fileName , "rb" )))	{
+		printf("Could not open input file %s \n",fileName);
+		return RESULT_ERROR;
+	}
+
+	//read content of a file into a buffer
+	res=fread (inputbuffer,sizeof(char),INPUT_BUFFER_MAX,inputfile);
+	fclose(inputfile);
+	if(res<INPUT_BUFFER_MAX && res>0)
+		totalChars=res;
+	else if (res==0)	{
+		printf("Error reading File %s . Empty file?\n",fileName);
+		return RESULT_ERROR;
+	}
+	else	{
+		printf("File %s is too large (%d) for the input buffer of size %d\n",fileName,res,INPUT_BUFFER_MAX);
+		return RESULT_ERROR;
+	}
+
+	totalwords=0;
+	extractWords(inputbuffer,totalChars,hashedwords,&totalwords);
+
+	sortHashedWords(hashedwords,totalwords,tempArray);
+
+	*distinctWords=0;
+	if(totalwords>0)
+		removeDuplicates(hashedwords,totalwords,distinctWords);
+	return 0;
+}
+
 int generateRandomNumbers() {
 	randnumbers[0]=41;
 	randnumbers[1]=18467;
@@ -0,0 +1,168 @@
+#include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+Checks that a small memory pool does not lose nodes which an insertion still uses.
+The program is built with a pool of a few frames and without the pinned area (see make pooltest),
+so every split - also the split of the root, which creates two new nodes - has to evict nodes.
+Sorted batches of random keys are inserted with the selected replacement policy,
+the tree is written, opened again and the number of documents of every key is compared with the expected one.
+
+To run: ./pooltest <btreefile> [clock|lru2|lastpath]
+The B-tree file and its size file are created and removed by the test
+*/
+int transfercounter;
+
+#define POOLTEST_KEYS 200000 //distinct keys
+#define POOLTEST_DOCUMENTS 600
+#define POOLTEST_KEYS_PER_DOCUMENT 300
+
+static unsigned int getTestKey(int i)
+{
+	return (unsigned int)i*2654435761u+1;
+}
+
+static int compareData(const void *first, const void *second)
+{
+	unsigned int a=((const Data_t *)first)->value;
+	unsigned int b=((const Data_t *)second)->value;
+
+	return (a>b)-(a<b);
+}
+
+/*opens the B-tree file and its size file, and creates the memory pool*/
+static int openTestTree(SystemState_t *state, char *btreeFileName, char *sizeFileName, int policy)
+{
+	memset(state,0,sizeof(SystemState_t));
+	state->replacementPolicy=policy;
+	state->backend=BACKEND_BUFFERED;
+	state->splitPolicy=SPLIT_HALF;
+	state->splitRatio=50;
+
+	if((state->btreefd=open(btreeFileName, O_RDWR | O_CREAT, 0644))<0)	{
+		printf("Could not open BTree file %s\n",btreeFileName);
+		return RESULT_ERROR;
+	}
+	if(!(state->sizefile=fopen(sizeFileName, "a+b")))	{
+		printf("Could not open size file %s\n",sizeFileName);
+		return RESULT_ERROR;
+	}
+	return initMemoryPool(state);
+}
+
+/*writes all nodes and the size of the tree, and closes the files*/
+static int closeTestTree(SystemState_t *state, char *sizeFileName)
+{
+	FILE *sizefile;
+
+	if(finish_SynchronizeData(state))
+		return RESULT_ERROR;
+	close(state->btreefd);
+	fclose(state->sizefile);
+
+	if(!(sizefile=fopen(sizeFileName, "wb")))	{
+		printf("Could not create size file %s\n",sizeFileName);
+		return RESULT_ERROR;
+	}
+	if(writeBTreeSize(sizefile,state->maxNodesOnDisk,state->freeListHead,state->freeNodesCount))
+		return RESULT_ERROR;
+	fclose(sizefile);
+	return RESULT_OK;
+}
+
+int main(int argc, char *argv[])
+{
+	SystemState_t state;
+	char sizeFileName[MAX_PATH_LENGTH];
+	Data_t run[POOLTEST_KEYS_PER_DOCUMENT];
+	int *expectedDocs;
+	int *lastDocument; //the last document of the key
+	int key;
+	unsigned int seed=12345;
+	int policy=REPLACE_LRU2;
+	int doc,i,count,height;
+	int totalDocs;
+	int failed=0;
+	BTreeNode_t *node;
+
+	if(argc<2)	{
+		printf("To run: ./pooltest <btreefile> [clock|lru2|lastpath]\n");
+		return RESULT_ERROR;
+	}
+	if(argc>2 && strcmp(argv[2],"clock")==0)
+		policy=REPLACE_CLOCK;
+	else if(argc>2 && strcmp(argv[2],"lastpath")==0)
+		policy=REPLACE_LASTPATH;
+	if(snprintf(sizeFileName,sizeof(sizeFileName),"%s_size",argv[1])>=(int)sizeof(sizeFileName))	{
+		printf("BTree file name %s is too long\n",argv[1]);
+		return RESULT_ERROR;
+	}
+	unlink(argv[1]);
+	unlink(sizeFileName);
+
+	expectedDocs=(int *) calloc (POOLTEST_KEYS, sizeof(int));
+	lastDocument=(int *) calloc (POOLTEST_KEYS, sizeof(int));
+	if(expectedDocs==NULL || lastDocument==NULL)	{
+		printf("Failed to allocate expected counts of %d keys\n",POOLTEST_KEYS);
+		return RESULT_ERROR;
+	}
+
+	if(openTestTree(&state, argv[1], sizeFileName, policy))
+		return RESULT_ERROR;
+	for(doc=1;doc<=POOLTEST_DOCUMENTS;doc++)	{
+		//distinct keys of the document, sorted
+		for(count=0,i=0;i<POOLTEST_KEYS_PER_DOCUMENT;i++)	{
+			seed=seed*1103515245+12345;
+			key=(seed>>8)%POOLTEST_KEYS;
+			if(lastDocument[key]==doc)
+				continue;
+			lastDocument[key]=doc;
+			expectedDocs[key]++;
+			run[count].value=getTestKey(key);
+			run[count++].pointer=doc;
+		}
+		qsort(run,count,sizeof(Data_t),compareData);
+
+		if(insertSortedBatchFromBuffer(&state, run, count))	{
+			printf("Failed to insert document %d\n",doc);
+			return RESULT_ERROR;
+		}
+		resetBTreePath(&state);
+	}
+	if(closeTestTree(&state, sizeFileName))
+		return RESULT_ERROR;
+
+	//the tree is read back from the file
+	if(openTestTree(&state, argv[1], sizeFileName, policy))
+		return RESULT_ERROR;
+	for(height=1,node=state.lastPath[0];node->header.nodeType!=LEAF;height++)	{
+		node=getNode(&state, node->data[0].pointer);
+		if(node==NULL)	{
+			printf("Leftmost node of level %d not found\n",height);
+			return RESULT_ERROR;
+		}
+	}
+	//the root was split at least once after it had internal children
+	if(height<3)	{
+		printf("The tree has %d levels, the root was not split\n",height);
+		failed++;
+	}
+
+	for(i=0;i<POOLTEST_KEYS;i++)	{
+		if(findWordHashInBTree(&state, getTestKey(i), &totalDocs) || totalDocs!=expectedDocs[i])	{
+			if(failed<10)
+				printf("Key %u has %d documents, expected %d\n",getTestKey(i),totalDocs,expectedDocs[i]);
+			failed++;
+		}
+	}
+	close(state.btreefd);
+	fclose(state.sizefile);
+	unlink(argv[1]);
+	unlink(sizeFileName);
+
+	printf("%s: %d frames, %d levels, %u nodes, %d wrong keys\n",failed ? "FAILED" : "PASSED",
+		MAX_NODES_INMEM,height,state.maxNodesOnDisk,failed);
+	return failed ? RESULT_ERROR : RESULT_OK;
+}
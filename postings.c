@@ -0,0 +1,222 @@
+#include "general.h"
+#include <string.h>
+
+/**
+Compressed posting lists of leaf keys.
+A document ID is stored as the difference from the previous document ID of the same key
+(from 0 for the first document), zigzag-mapped so that a document which comes out of order
+still has a small code, and written as a varint: 7 bits per byte, the high bit says that the number continues.
+Documents arrive in increasing order, so most differences take 1 or 2 bytes
+instead of 8 bytes of a Data_t element.
+
+The varints of a key are kept in a chain of PostingBlock_t blocks in the postings heap of the leaf.
+Blocks are allocated from the end of the heap, as Data_t elements were, and a varint may continue
+in the next block. All blocks except the last one are full, so the posting header
+(last block, bytes used in it, last document ID) is enough to append in O(1)
+*/
+
+static unsigned int zigzagEncode(int delta)
+{
+	return ((unsigned int)delta<<1)^(unsigned int)(delta>>31);
+}
+
+static int zigzagDecode(unsigned int code)
+{
+	return (int)(code>>1)^-(int)(code&1);
+}
+
+/*takes the next free block of the leaf*/
+static short allocatePostingBlock(BTreeNode_t *leaf)
+{
+	short pos=(leaf->header.dataFreePosArrID)--;
+
+	leaf->leaf.postings[pos].next=0;
+	return pos;
+}
+
+/*
+encodes the document as a varint difference from the last document of the key,
+returns the number of bytes written into code (at most POSTING_VARINT_MAX_BYTES)
+*/
+int encodePosting(PostingHeader_t *postingHeader, unsigned int docID, unsigned char *code)
+{
+	int codeBytes=0;
+	unsigned int value;
+
+	value=zigzagEncode((int)(docID-((postingHeader->docsCount==0) ? 0 : postingHeader->lastDocID)));
+	while(value>=0x80)	{
+		code[codeBytes++]=(unsigned char)(value|0x80);
+		value>>=7;
+	}
+	code[codeBytes++]=(unsigned char)value;
+	return codeBytes;
+}
+
+/*
+decodes the next bytesCount bytes of a posting list into docIDs, returns the number of decoded documents.
+The decoder keeps a varint which continues in the next bytes, 
+so a list is decoded chunk by chunk - block by block or page by page
+*/
+int decodePostingBytes(PostingDecoder_t *decoder, unsigned char *bytes, int bytesCount, unsigned int *docIDs)
+{
+	int count=0;
+	int i;
+	unsigned char byte;
+
+	for(i=0;i<bytesCount;i++)	{
+		byte=bytes[i];
+		//most differences are 1 byte: no shifting and accumulation for them
+		if(decoder->shift==0 && byte<0x80)	{
+			decoder->docID+=zigzagDecode(byte);
+			docIDs[count++]=decoder->docID;
+			continue;
+		}
+		decoder->value|=(unsigned int)(byte&0x7f)<<decoder->shift;
+		if(byte&0x80)	{
+			decoder->shift+=7;
+			continue;
+		}
+		decoder->docID+=zigzagDecode(decoder->value);
+		docIDs[count++]=decoder->docID;
+		decoder->value=0;
+		decoder->shift=0;
+	}
+	return count;
+}
+
+/*
+appends document ID to the posting list of the key.
+docsCount==0 in the posting header starts a new list.
+The leaf needs at most one free block for this, which the callers check before inserting
+*/
+int appendPosting(BTreeNode_t *leaf, PostingHeader_t *postingHeader, unsigned int docID)
+{
+	unsigned char code[POSTING_VARINT_MAX_BYTES];
+	int codeBytes;
+	int blocksNeeded;
+	PostingBlock_t *block;
+	short newBlock;
+	int i;
+
+	codeBytes=encodePosting(postingHeader, docID, code);
+
+	if(postingHeader->docsCount==0)
+		blocksNeeded=1;
+	else
+		blocksNeeded=(postingHeader->lastBlockBytes+codeBytes>POSTING_BLOCK_BYTES) ? 1 : 0;
+	if(leaf->header.dataFreePosArrID<blocksNeeded)	{
+		printf("No free posting block in leaf %u for document %u\n",leaf->header.nodeID,docID);
+		return RESULT_ERROR;
+	}
+
+	if(postingHeader->docsCount==0)	{
+		newBlock=allocatePostingBlock(leaf);
+		postingHeader->firstBlock=newBlock;
+		postingHeader->lastBlock=newBlock;
+		postingHeader->lastBlockBytes=0;
+	}
+
+	block=&leaf->leaf.postings[postingHeader->lastBlock];
+	for(i=0;i<codeBytes;i++)	{
+		if(postingHeader->lastBlockBytes==POSTING_BLOCK_BYTES)	{
+			newBlock=allocatePostingBlock(leaf);
+			block->next=newBlock;
+			block=&leaf->leaf.postings[newBlock];
+			postingHeader->lastBlock=newBlock;
+			postingHeader->lastBlockBytes=0;
+		}
+		block->bytes[postingHeader->lastBlockBytes++]=code[i];
+	}
+
+	postingHeader->docsCount++;
+	postingHeader->lastDocID=docID;
+	return RESULT_OK;
+}
+
+/*
+decodes all documents of the key from the leaf blocks into docIDs, which must hold docsCount elements.
+Returns the number of decoded documents
+*/
+int decodePostings(LeafPage_t *page, PostingHeader_t *postingHeader, unsigned int *docIDs)
+{
+	PostingDecoder_t decoder={0,0,0};
+	short pos=postingHeader->firstBlock;
+	int count=0;
+
+	while(count<postingHeader->docsCount && pos!=0)	{
+		count+=decodePostingBytes(&decoder, page->postings[pos].bytes, 
+			(pos==postingHeader->lastBlock) ? postingHeader->lastBlockBytes : POSTING_BLOCK_BYTES,
+			&docIDs[count]);
+		pos=page->postings[pos].next;
+	}
+
+	if(count!=postingHeader->docsCount)
+		printf("Posting list is broken: decoded %d documents of %d\n",count,postingHeader->docsCount);
+	return count;
+}
+
+/*returns the number of leaf blocks taken by the posting list of the key, 0 for a list in overflow pages*/
+int countPostingBlocks(LeafPage_t *page, PostingHeader_t *postingHeader)
+{
+	short pos;
+	int count=0;
+
+	if(postingHeader->lastBlockBytes==POSTINGS_IN_OVERFLOW)
+		return 0;
+	for(pos=postingHeader->firstBlock;pos!=0;pos=page->postings[pos].next)
+		count++;
+	return count;
+}
+
+/*
+copies the posting list of a key from fromPage into the free blocks of leaf.
+The blocks are copied as they are, without decoding.
+A list in overflow pages stays there, only its header is copied
+*/
+int copyPostingList(BTreeNode_t *leaf, LeafPage_t *fromPage,
+					PostingHeader_t *fromHeader, PostingHeader_t *toHeader)
+{
+	short pos=fromHeader->firstBlock;
+	short newBlock;
+	short prevBlock=0;
+
+	*toHeader=*fromHeader;
+	if(fromHeader->lastBlockBytes==POSTINGS_IN_OVERFLOW)
+		return RESULT_OK;
+
+	while(pos!=0)	{
+		if(leaf->header.dataFreePosArrID<=0)	{
+			printf("No free posting block in leaf %u to copy a posting list\n",leaf->header.nodeID);
+			return RESULT_ERROR;
+		}
+		newBlock=allocatePostingBlock(leaf);
+		leaf->leaf.postings[newBlock]=fromPage->postings[pos];
+		leaf->leaf.postings[newBlock].next=0;
+		if(prevBlock==0)
+			toHeader->firstBlock=newBlock;
+		else
+			leaf->leaf.postings[prevBlock].next=newBlock;
+		prevBlock=newBlock;
+		pos=fromPage->postings[pos].next;
+	}
+	toHeader->lastBlock=prevBlock;
+	return RESULT_OK;
+}
+
+/*
+blocks are never freed one by one: when posting lists leave the leaf,
+all remaining lists are copied anew to the end of the heap
+*/
+int compactPostings(BTreeNode_t *leaf)
+{
+	LeafPage_t oldPage;
+	int i;
+
+	memcpy(&oldPage,&leaf->leaf,sizeof(LeafPage_t));
+	leaf->header.dataFreePosArrID=LEAF_MAX_POSTING_BLOCKS-1;
+	for(i=0;i<leaf->header.keysCount;i++)	{
+		if(copyPostingList(leaf, &oldPage, &oldPage.postingHeaders[i], &leaf->leaf.postingHeaders[i]))
+			return RESULT_ERROR;
+	}
+	return RESULT_OK;
+}
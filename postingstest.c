@@ -0,0 +1,416 @@
+#include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+Checks the decoded posting lists of a B-tree file against the documents it was built from.
+The program has two modes, which make test runs around bulkload, onlineupdate with compaction and vacuum:
+
+generate - writes documents <folder>doc1.txt ... with words of a skewed vocabulary,
+so that a few keys are in most documents and their posting lists move to overflow pages.
+check - parses the documents as onlineupdate does, and expects every (key, docID) pair exactly once,
+either in the B-tree or in the buffer file. Onlineupdate does not read the buffer file of its previous run,
+so the pairs which were left in that file are not expected, if it is given as droppedbufferfile. The B-tree is scanned with a cursor from the first to the last key,
+and the posting lists are decoded with readCursorPostings, also those in overflow chains.
+The scan runs once through the buffered memory pool and once through the mmap backend.
+DocID of document i is i, as with filedelta 0.
+
+To run: ./postingstest generate <folder> <documents>
+./postingstest check <folder> <documents> <btreefile> <bufferfile> [droppedbufferfile]
+The buffer file may be missing, then all pairs are expected in the B-tree
+*/
+int transfercounter;
+
+#define POSTINGSTEST_VOCABULARY 20000
+#define POSTINGSTEST_WORDS_PER_DOCUMENT 150
+#define POSTINGSTEST_HEAVY_WORDS 8
+
+typedef struct
+{
+	Data_t *pairs; //value is the key, pointer is the docID
+	int count;
+	int capacity;
+}PairList_t;
+
+static int compareData(const void *first, const void *second)
+{
+	const Data_t *a=(const Data_t *)first;
+	const Data_t *b=(const Data_t *)second;
+
+	if(a->value!=b->value)
+		return (a->value>b->value)-(a->value<b->value);
+	return (a->pointer>b->pointer)-(a->pointer<b->pointer);
+}
+
+static int addPair(PairList_t *list, unsigned int key, unsigned int docID)
+{
+	Data_t *pairs;
+
+	if(list->count==list->capacity)	{
+		list->capacity=list->capacity ? 2*list->capacity : 1024*1024;
+		pairs=(Data_t *) realloc (list->pairs, (size_t)list->capacity*sizeof(Data_t));
+		if(pairs==NULL)	{
+			printf("Failed to allocate memory for %d pairs\n",list->capacity);
+			return RESULT_ERROR;
+		}
+		list->pairs=pairs;
+	}
+	list->pairs[list->count].value=key;
+	list->pairs[list->count++].pointer=docID;
+	return RESULT_OK;
+}
+
+/*word i of the vocabulary: a letter prefix and i in base 26*/
+static void writeWord(FILE *file, int i)
+{
+	fputc('w',file);
+	do	{
+		fputc('a'+i%26,file);
+		i/=26;
+	}while(i>0);
+}
+
+static int generateDocuments(char *folder, int documents)
+{
+	char fileName[MAX_PATH_LENGTH];
+	unsigned int seed=12345;
+	unsigned int a,b;
+	FILE *file;
+	int doc,i;
+
+	for(doc=1;doc<=documents;doc++)	{
+		if(snprintf(fileName,sizeof(fileName),"%sdoc%d.txt",folder,doc)>=(int)sizeof(fileName))	{
+			printf("Folder name %s is too long\n",folder);
+			return RESULT_ERROR;
+		}
+		if(!(file=fopen(fileName, "w")))	{
+			printf("Could not create document %s\n",fileName);
+			return RESULT_ERROR;
+		}
+		//word i of the first POSTINGSTEST_HEAVY_WORDS is in every (i+1)-th document
+		for(i=0;i<POSTINGSTEST_HEAVY_WORDS;i++)	{
+			if(doc%(i+1)==0)	{
+				writeWord(file,i);
+				fputc(' ',file);
+			}
+		}
+		for(i=0;i<POSTINGSTEST_WORDS_PER_DOCUMENT;i++)	{
+			seed=seed*1103515245+12345;
+			a=(seed>>8)%POSTINGSTEST_VOCABULARY;
+			seed=seed*1103515245+12345;
+			b=(seed>>8)%POSTINGSTEST_VOCABULARY;
+			writeWord(file,POSTINGSTEST_HEAVY_WORDS+(int)(a*b/POSTINGSTEST_VOCABULARY)); //the product makes small words frequent
+			fputc(' ',file);
+		}
+		fputc('\n',file);
+		fclose(file);
+	}
+	printf("Generated %d documents in %s\n",documents,folder);
+	return RESULT_OK;
+}
+
+/*(key, docID) pairs of all documents*/
+static int readExpectedPairs(char *folder, int documents, PairList_t *expected)
+{
+	char fileName[MAX_PATH_LENGTH];
+	char *inputbuffer;
+	unsigned int *hashedwords;
+	unsigned int *temparray;
+	int distinctWords;
+	int doc,i;
+
+	inputbuffer=(char *) calloc (INPUT_BUFFER_MAX, sizeof(char));
+	hashedwords=(unsigned int *) calloc (INPUT_BUFFER_MAX, sizeof(unsigned int));
+	temparray=(unsigned int *) calloc (INPUT_BUFFER_MAX, sizeof(unsigned int));
+	if(inputbuffer==NULL || hashedwords==NULL || temparray==NULL)	{
+		printf("Failed to allocate memory for parsing documents\n");
+		return RESULT_ERROR;
+	}
+
+	prepareCodeTable();
+	for(doc=1;doc<=documents;doc++)	{
+		if(snprintf(fileName,sizeof(fileName),"%sdoc%d.txt",folder,doc)>=(int)sizeof(fileName))	{
+			printf("Folder name %s is too long\n",folder);
+			return RESULT_ERROR;
+		}
+		if(readDocumentWords(fileName,inputbuffer,hashedwords,temparray,&distinctWords))
+			return RESULT_ERROR;
+		for(i=0;i<distinctWords;i++)	{
+			if(addPair(expected,hashedwords[i],doc))
+				return RESULT_ERROR;
+		}
+	}
+	free(inputbuffer);
+	free(hashedwords);
+	free(temparray);
+	return RESULT_OK;
+}
+
+/*collects the keys of the buckets under a child of a top tree node: a bucket if negative, 0 if none*/
+static int collectBucketPairs(TopTree_t *tree, Bucket_t *buckets, int child, PairList_t *found)
+{
+	Bucket_t *bucket;
+	int i;
+
+	if(child==0)
+		return RESULT_OK;
+	if(child<0)	{
+		if(-child>=tree->header.bucketsCounter)	{
+			printf("Buffer file refers to bucket %d of %d\n",-child,tree->header.bucketsCounter);
+			return RESULT_ERROR;
+		}
+		bucket=&buckets[-child];
+		for(i=0;i<bucket->header.keysCount;i++)	{
+			if(addPair(found,bucket->data[i].value,bucket->data[i].pointer))
+				return RESULT_ERROR;
+		}
+		return RESULT_OK;
+	}
+	if(child>=tree->header.nodesCounter)	{
+		printf("Buffer file refers to top tree node %d of %d\n",child,tree->header.nodesCounter);
+		return RESULT_ERROR;
+	}
+	if(collectBucketPairs(tree, buckets, tree->nodes[child].children[0], found))
+		return RESULT_ERROR;
+	return collectBucketPairs(tree, buckets, tree->nodes[child].children[1], found);
+}
+
+/*pairs which are still in the buffer file*/
+static int readBufferPairs(char *bufferFileName, PairList_t *found)
+{
+	TopTree_t tree;
+	Bucket_t *buckets;
+	FILE *file;
+	int i;
+
+	if(!(file=fopen(bufferFileName, "rb")))
+		return RESULT_OK;
+	if(fread(&tree.header,sizeof(TopTreeHeader_t),1,file)!=1 || tree.header.nodesCounter<1 || tree.header.bucketsCounter<1)	{
+		printf("Buffer file %s has no valid header\n",bufferFileName);
+		return RESULT_ERROR;
+	}
+	tree.nodes=(TopTreeNode_t *) calloc (tree.header.nodesCounter, sizeof(TopTreeNode_t));
+	buckets=(Bucket_t *) calloc (tree.header.bucketsCounter, sizeof(Bucket_t));
+	if(tree.nodes==NULL || buckets==NULL)	{
+		printf("Failed to allocate memory for buffer file %s\n",bufferFileName);
+		return RESULT_ERROR;
+	}
+	if(fread(tree.nodes,sizeof(TopTreeNode_t),tree.header.nodesCounter,file)!=(size_t)tree.header.nodesCounter)	{
+		printf("Failed to read top tree of buffer file %s\n",bufferFileName);
+		return RESULT_ERROR;
+	}
+	for(i=0;i<tree.header.bucketsCounter;i++)	{
+		if(fread(&buckets[i].header,sizeof(BucketHeader_t),1,file)!=1)	{
+			printf("Failed to read header of bucket %d from buffer file %s\n",i,bufferFileName);
+			return RESULT_ERROR;
+		}
+	}
+	for(i=0;i<tree.header.bucketsCounter;i++)	{
+		buckets[i].data=(Data_t *) malloc ((buckets[i].header.keysCount+1)*sizeof(Data_t));
+		if(buckets[i].data==NULL
+			|| fread(buckets[i].data,sizeof(Data_t),buckets[i].header.keysCount,file)!=(size_t)buckets[i].header.keysCount)	{
+			printf("Failed to read keys of bucket %d from buffer file %s\n",i,bufferFileName);
+			return RESULT_ERROR;
+		}
+	}
+	fclose(file);
+
+	if(collectBucketPairs(&tree, buckets, tree.nodes[0].children[0], found)
+		|| collectBucketPairs(&tree, buckets, tree.nodes[0].children[1], found))
+		return RESULT_ERROR;
+	for(i=0;i<tree.header.bucketsCounter;i++)
+		free(buckets[i].data);
+	free(buckets);
+	free(tree.nodes);
+	return RESULT_OK;
+}
+
+/*removes the pairs of the dropped buffer from the sorted expected pairs, they all have to be there*/
+static int removeDroppedPairs(PairList_t *expected, PairList_t *dropped)
+{
+	int i,j=0;
+	int count=0;
+	int cmp;
+
+	qsort(dropped->pairs,dropped->count,sizeof(Data_t),compareData);
+	for(i=0;i<expected->count;i++)	{
+		cmp=(j<dropped->count) ? compareData(&expected->pairs[i],&dropped->pairs[j]) : -1;
+		if(cmp>0)	{
+			printf("Dropped document %u of key %u is not expected\n",dropped->pairs[j].pointer,dropped->pairs[j].value);
+			return RESULT_ERROR;
+		}
+		if(cmp==0)
+			j++;
+		else
+			expected->pairs[count++]=expected->pairs[i];
+	}
+	if(j<dropped->count)	{
+		printf("Dropped document %u of key %u is not expected\n",dropped->pairs[j].pointer,dropped->pairs[j].value);
+		return RESULT_ERROR;
+	}
+	expected->count=count;
+	return RESULT_OK;
+}
+
+/*
+scans all keys of the B-tree with a cursor and decodes their posting lists.
+Keys must come in increasing order, and every list must have as many documents as its header says
+*/
+static int scanPostings(SystemState_t *state, PairList_t *found, int maxDocs)
+{
+	BTreeCursor_t cursor;
+	unsigned int *docIDs;
+	unsigned int previousKey=0;
+	int keys=0;
+	int docsCount,i,res;
+
+	docIDs=(unsigned int *) calloc (maxDocs+1, sizeof(unsigned int));
+	if(docIDs==NULL)	{
+		printf("Failed to allocate memory for %d docIDs\n",maxDocs);
+		return RESULT_ERROR;
+	}
+	if(seekCursor(state, &cursor, 0, MAX_UNSIGNED_INT))
+		return RESULT_ERROR;
+	while((res=nextCursor(&cursor))==RESULT_OK)	{
+		if(keys>0 && cursor.key<=previousKey)	{
+			printf("Key %u follows key %u in the scan\n",cursor.key,previousKey);
+			return RESULT_ERROR;
+		}
+		previousKey=cursor.key;
+		keys++;
+		if(cursor.postingHeader.docsCount>maxDocs)	{
+			printf("Key %u has %d documents, there are only %d\n",cursor.key,cursor.postingHeader.docsCount,maxDocs);
+			return RESULT_ERROR;
+		}
+		docsCount=readCursorPostings(&cursor, docIDs);
+		if(docsCount!=cursor.postingHeader.docsCount)	{
+			printf("Decoded %d documents of key %u, expected %d\n",docsCount,cursor.key,cursor.postingHeader.docsCount);
+			return RESULT_ERROR;
+		}
+		for(i=0;i<docsCount;i++)	{
+			if(addPair(found,cursor.key,docIDs[i]))
+				return RESULT_ERROR;
+		}
+	}
+	free(docIDs);
+	if(res==RESULT_ERROR)
+		return RESULT_ERROR;
+	return RESULT_OK;
+}
+
+/*compares sorted lists and reports the first differences*/
+static int comparePairs(PairList_t *expected, PairList_t *found)
+{
+	int i=0,j=0;
+	int failed=0;
+	int cmp;
+
+	while(i<expected->count || j<found->count)	{
+		if(i==expected->count)
+			cmp=1;
+		else if(j==found->count)
+			cmp=-1;
+		else
+			cmp=compareData(&expected->pairs[i],&found->pairs[j]);
+		if(cmp==0)	{
+			i++;
+			j++;
+			continue;
+		}
+		if(failed<10)	{
+			if(cmp<0)
+				printf("Document %u of key %u is missing\n",expected->pairs[i].pointer,expected->pairs[i].value);
+			else
+				printf("Document %u of key %u is not expected\n",found->pairs[j].pointer,found->pairs[j].value);
+		}
+		failed++;
+		if(cmp<0)
+			i++;
+		else
+			j++;
+	}
+	return failed;
+}
+
+static int checkPostings(int documents, char *btreeFileName, char *bufferFileName, int backend,
+						 PairList_t *expected, PairList_t *found)
+{
+	SystemState_t state;
+	char sizeFileName[MAX_PATH_LENGTH];
+	int bufferPairs;
+	int failed;
+
+	if(snprintf(sizeFileName,sizeof(sizeFileName),"%s_size",btreeFileName)>=(int)sizeof(sizeFileName))	{
+		printf("BTree file name %s is too long\n",btreeFileName);
+		return RESULT_ERROR;
+	}
+	found->count=0;
+	if(readBufferPairs(bufferFileName, found))
+		return RESULT_ERROR;
+	bufferPairs=found->count;
+
+	memset(&state,0,sizeof(SystemState_t));
+	state.backend=backend;
+	state.splitPolicy=SPLIT_HALF;
+	state.splitRatio=50;
+	if((state.btreefd=open(btreeFileName, O_RDWR))<0)	{
+		printf("Could not open BTree file %s\n",btreeFileName);
+		return RESULT_ERROR;
+	}
+	if(!(state.sizefile=fopen(sizeFileName, "r+b")))	{
+		printf("Could not open size file %s\n",sizeFileName);
+		return RESULT_ERROR;
+	}
+	if(initMemoryPool(&state))
+		return RESULT_ERROR;
+	if(scanPostings(&state, found, documents))
+		return RESULT_ERROR;
+	close(state.btreefd);
+	fclose(state.sizefile);
+
+	qsort(found->pairs,found->count,sizeof(Data_t),compareData);
+	failed=comparePairs(expected, found);
+	printf("%s: %s backend, %d pairs expected, %d in the B-tree of %u nodes and %d in the buffer, %d wrong\n",
+		failed ? "FAILED" : "PASSED",backend==BACKEND_MMAP ? "mmap" : "buffered",
+		expected->count,found->count-bufferPairs,state.maxNodesOnDisk,bufferPairs,failed);
+	return failed ? RESULT_ERROR : RESULT_OK;
+}
+
+int main(int argc, char *argv[])
+{
+	PairList_t expected={NULL,0,0};
+	PairList_t found={NULL,0,0};
+	int documents;
+
+	if(argc<4 || (strcmp(argv[1],"check")==0 && argc<6))	{
+		printf("To run: ./postingstest generate <folder> <documents>\n");
+		printf("or: ./postingstest check <folder> <documents> <btreefile> <bufferfile> [droppedbufferfile]\n");
+		return RESULT_ERROR;
+	}
+	documents=atoi(argv[3]);
+	if(documents<1)	{
+		printf("Invalid number of documents %s\n",argv[3]);
+		return RESULT_ERROR;
+	}
+	if(strcmp(argv[1],"generate")==0)
+		return generateDocuments(argv[2], documents);
+	if(strcmp(argv[1],"check")!=0)	{
+		printf("Unknown mode %s, expected generate or check\n",argv[1]);
+		return RESULT_ERROR;
+	}
+
+	if(readExpectedPairs(argv[2], documents, &expected))
+		return RESULT_ERROR;
+	qsort(expected.pairs,expected.count,sizeof(Data_t),compareData);
+	if(argc>6)	{
+		if(readBufferPairs(argv[6], &found) || removeDroppedPairs(&expected, &found))
+			return RESULT_ERROR;
+		printf("%d pairs of dropped buffer file %s are not expected\n",found.count,argv[6]);
+	}
+
+	if(checkPostings(documents, argv[4], argv[5], BACKEND_BUFFERED, &expected, &found)
+		|| checkPostings(documents, argv[4], argv[5], BACKEND_MMAP, &expected, &found))
+		return RESULT_ERROR;
+	return RESULT_OK;
+}
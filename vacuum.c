@@ -0,0 +1,237 @@
+#include "general.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+Rewrites a B-tree file so that its nodes are laid out in key order.
+onlineupdate appends every new node to the end of the file (or puts it into a free node),
+so after a while neighbour leaves are scattered over the file, and a range scan or a bucket transfer
+which touches neighbour leaves reads them with random I/O.
+
+The new file has the root at node 0, then the internal nodes level by level, each level in key order,
+then all leaves in key order, and then the overflow pages, each chain in consecutive pages in key order.
+Nodes are copied as they are, only node IDs are renumbered: child pointers, leaf sibling links
+and overflow page links are translated. FREE nodes are not copied, so the new file has no free list.
+
+The order of the nodes is found by reading the internal levels breadth-first,
+then the nodes are read in this order in batches of ASYNC_READ_QUEUE_DEPTH and written sequentially.
+
+To run: ./vacuum <oldbtreefile> <newbtreefile>
+The size file <newbtreefile>_size is created next to the new B-tree file.
+The buffer file oldbtreefile_buffer can be copied as newbtreefile_buffer
+*/
+int transfercounter;
+
+typedef struct
+{
+	int newfd;
+	unsigned int *order; //old node IDs in the new order: internal levels, then leaves
+	unsigned int *newIDs; //old node ID -> new node ID
+	unsigned int treeNodesCount; //root, internal nodes and leaves
+	unsigned int leavesStart; //position of the first leaf in order
+	unsigned int nextOverflowID; //overflow chains are written after the leaves
+}Vacuum_t;
+
+/*
+lists the nodes of the tree breadth-first: order is the queue of the traversal.
+Children of each node are in key order, so every level, and the leaves, come out in key order.
+Only internal nodes are read - the traversal stops at the first leaf
+*/
+static int orderTreeNodes(SystemState_t *state, Vacuum_t *vacuum)
+{
+	BTreeNode_t *node;
+	unsigned int queued=1;
+	unsigned int i;
+	int j;
+
+	vacuum->order[0]=0;
+	for(i=0;i<queued;i++)	{
+		if(i%ASYNC_READ_QUEUE_DEPTH==0 && prefetchNodes(state, &vacuum->order[i], MIN(ASYNC_READ_QUEUE_DEPTH, queued-i)))
+			return RESULT_ERROR;
+
+		node=getNode(state, vacuum->order[i]);
+		if(node==NULL)	{
+			printf("Node %u not found\n",vacuum->order[i]);
+			return RESULT_ERROR;
+		}
+		if(node->header.nodeType==LEAF) //all nodes after it in the queue are leaves
+			break;
+		if(node->header.nodeType!=ROOT && node->header.nodeType!=INTERNAL)	{
+			printf("Node %u of type %d is a child in the tree\n",node->header.nodeID,node->header.nodeType);
+			return RESULT_ERROR;
+		}
+
+		for(j=0;j<node->header.keysCount;j++)	{
+			if((unsigned int)node->data[j].pointer>=state->maxNodesOnDisk || queued>=state->maxNodesOnDisk)	{
+				printf("Invalid child %d of node %u\n",node->data[j].pointer,node->header.nodeID);
+				return RESULT_ERROR;
+			}
+			vacuum->order[queued++]=node->data[j].pointer;
+		}
+	}
+
+	vacuum->treeNodesCount=queued;
+	vacuum->leavesStart=i;
+	vacuum->nextOverflowID=queued;
+	for(i=0;i<queued;i++)
+		vacuum->newIDs[vacuum->order[i]]=i;
+	return RESULT_OK;
+}
+
+/*
+copies the overflow chain which starts with oldPageID into consecutive pages after the previous chains.
+The first page is written last, when the ID of the last page is known.
+Returns the new ID of the first page, 0 on error
+*/
+static unsigned int copyOverflowChain(SystemState_t *state, Vacuum_t *vacuum, unsigned int oldPageID)
+{
+	BTreeNode_t page;
+	BTreeNode_t firstPage;
+	BTreeNode_t *oldPage;
+	unsigned int firstPageID=vacuum->nextOverflowID;
+
+	while(oldPageID!=0)	{
+		oldPage=getNode(state, oldPageID);
+		if(oldPage==NULL || oldPage->header.nodeType!=OVERFLOW)	{
+			printf("Overflow page %u not found\n",oldPageID);
+			return 0;
+		}
+		memcpy(&page,oldPage,sizeof(BTreeNode_t));
+		oldPageID=page.overflow.nextPage;
+
+		page.header.nodeID=vacuum->nextOverflowID++;
+		page.overflow.nextPage=(oldPageID!=0) ? vacuum->nextOverflowID : 0;
+		if(page.header.nodeID==firstPageID)
+			memcpy(&firstPage,&page,sizeof(BTreeNode_t));
+		else if(writeNodeToFile(vacuum->newfd, &page))
+			return 0;
+	}
+
+	firstPage.overflow.lastPage=vacuum->nextOverflowID-1;
+	if(writeNodeToFile(vacuum->newfd, &firstPage))
+		return 0;
+	return firstPageID;
+}
+
+/*copies node order[pos] with translated node IDs into its new place*/
+static int copyNode(SystemState_t *state, Vacuum_t *vacuum, unsigned int pos)
+{
+	BTreeNode_t node;
+	BTreeNode_t *oldNode;
+	PostingHeader_t *postingHeader;
+	int i;
+
+	oldNode=getNode(state, vacuum->order[pos]);
+	if(oldNode==NULL)	{
+		printf("Node %u not found\n",vacuum->order[pos]);
+		return RESULT_ERROR;
+	}
+	memcpy(&node,oldNode,sizeof(BTreeNode_t));
+	node.header.nodeID=pos;
+
+	if(node.header.nodeType!=LEAF)	{
+		for(i=0;i<node.header.keysCount;i++)
+			node.data[i].pointer=vacuum->newIDs[node.data[i].pointer];
+		return writeNodeToFile(vacuum->newfd, &node);
+	}
+
+	//0 - no neighbour, node 0 is the root and keeps its ID
+	node.leaf.prevLeaf=vacuum->newIDs[node.leaf.prevLeaf];
+	node.leaf.nextLeaf=vacuum->newIDs[node.leaf.nextLeaf];
+	for(i=0;i<node.header.keysCount;i++)	{
+		postingHeader=&node.leaf.postingHeaders[i];
+		if(postingHeader->lastBlockBytes!=POSTINGS_IN_OVERFLOW)
+			continue;
+		postingHeader->overflowPage=copyOverflowChain(state, vacuum, postingHeader->overflowPage);
+		if(postingHeader->overflowPage==0)
+			return RESULT_ERROR;
+	}
+	return writeNodeToFile(vacuum->newfd, &node);
+}
+
+int main(int argc, char *argv[])
+{
+	SystemState_t state;
+	Vacuum_t vacuum;
+	char oldSizeFileName[MAX_PATH_LENGTH];
+	char newSizeFileName[MAX_PATH_LENGTH];
+	FILE *sizefile;
+	unsigned int i;
+
+	if(argc<3)	{
+		printf("To run: ./vacuum <oldbtreefile> <newbtreefile>\n");
+		return RESULT_ERROR;
+	}
+	if(snprintf(oldSizeFileName,sizeof(oldSizeFileName),"%s_size", argv[1])>=(int)sizeof(oldSizeFileName)
+		|| snprintf(newSizeFileName,sizeof(newSizeFileName),"%s_size", argv[2])>=(int)sizeof(newSizeFileName))	{
+		printf("BTree file name %s or %s is too long\n",argv[1],argv[2]);
+		return RESULT_ERROR;
+	}
+
+	//the old tree is only read through the memory pool
+	memset(&state,0,sizeof(SystemState_t));
+	state.replacementPolicy=REPLACE_CLOCK;
+	state.backend=BACKEND_BUFFERED;
+	if((state.btreefd=open(argv[1], O_RDONLY))<0)	{
+		printf("Could not open old BTree file %s \n",argv[1]);
+		return RESULT_ERROR;
+	}
+	if(!(state.sizefile= fopen ( oldSizeFileName , "rb" )))	{
+		printf("Could not open old size file %s \n",oldSizeFileName);
+		return RESULT_ERROR;
+	}
+	if(getBTreeSize(&state)==0)	{
+		printf("BTree file %s is empty\n",argv[1]);
+		return RESULT_ERROR;
+	}
+	if(initMemoryPool(&state))
+		return RESULT_ERROR;
+
+	memset(&vacuum,0,sizeof(Vacuum_t));
+	vacuum.order=(unsigned int*) calloc (state.maxNodesOnDisk, sizeof(unsigned int));
+	vacuum.newIDs=(unsigned int*) calloc (state.maxNodesOnDisk, sizeof(unsigned int));
+	if(vacuum.order==NULL || vacuum.newIDs==NULL)	{
+		printf("Failed to allocate node order for %u nodes\n",state.maxNodesOnDisk);
+		return RESULT_ERROR;
+	}
+
+	//the new B-tree file is created from scratch, an existing file is never overwritten
+	if((vacuum.newfd=open(argv[2], O_RDWR | O_CREAT | O_EXCL, 0644))<0)	{
+		printf("Could not create new BTree file %s - it should not exist\n",argv[2]);
+		return RESULT_ERROR;
+	}
+
+	if(orderTreeNodes(&state, &vacuum))	{
+		printf("Failed to traverse BTree file %s\n",argv[1]);
+		return RESULT_ERROR;
+	}
+
+	for(i=0;i<vacuum.treeNodesCount;i++)	{
+		//leaves are scattered in the old file - they are read ahead in batches
+		if(i>=vacuum.leavesStart && (i-vacuum.leavesStart)%ASYNC_READ_QUEUE_DEPTH==0
+			&& prefetchNodes(&state, &vacuum.order[i], MIN(ASYNC_READ_QUEUE_DEPTH, vacuum.treeNodesCount-i)))
+			return RESULT_ERROR;
+		if(copyNode(&state, &vacuum, i))	{
+			printf("Failed to copy node %u of BTree file %s\n",vacuum.order[i],argv[1]);
+			return RESULT_ERROR;
+		}
+	}
+
+	close(vacuum.newfd);
+	close(state.btreefd);
+	fclose(state.sizefile);
+
+	if(!(sizefile= fopen ( newSizeFileName , "wb" )))	{
+		printf("Could not create new size file %s \n",newSizeFileName);
+		return RESULT_ERROR;
+	}
+	if(writeBTreeSize(sizefile,vacuum.nextOverflowID,0,0))
+		return RESULT_ERROR;
+	fclose(sizefile);
+
+	printf("Rewrote %u internal nodes, %u leaves and %u overflow pages in key order, %u of %u nodes are left out\n",
+		vacuum.leavesStart,vacuum.treeNodesCount-vacuum.leavesStart,vacuum.nextOverflowID-vacuum.treeNodesCount,
+		state.maxNodesOnDisk-vacuum.nextOverflowID,state.maxNodesOnDisk);
+	return RESULT_OK;
+}